@@ -0,0 +1,210 @@
+
+#pragma once
+
+// Bump allocator for memory that only lives while one texture group is processed.
+// Freeing only gives back the last allocation, arena_reset() rewinds it and keeps the memory for the next group.
+// Not thread safe, only allocate from the thread that processes the group.
+
+constexpr u64 ARENA_BLOCK_SIZE = 64 * 1024 * 1024;
+constexpr u64 ARENA_ALIGNMENT = 16;
+
+struct ArenaBlock
+{
+	u8 *base;
+	u64 size;
+	u64 used;
+};
+
+struct Arena
+{
+	std::vector<ArenaBlock> blocks;
+	u64 current;
+	u64 used;			// bytes handed out since the last reset
+	u64 peak;			// most bytes handed out between two resets
+	u64 reserved;		// bytes held in blocks
+	u64 allocations;
+	u8 *last;			// the most recent allocation, the only one that can be freed
+	u64 lastStart;		// used of the current block before it
+	std::chrono::steady_clock::duration time;
+};
+
+static u64 arena_align( u64 value, u64 alignment )
+{
+	return ( value + alignment - 1 ) & ~( alignment - 1 );
+}
+
+static void *arena_alloc( Arena *arena, u64 size, u64 alignment = ARENA_ALIGNMENT )
+{
+	auto start = std::chrono::steady_clock::now();
+
+	size = arena_align( std::max( size, (u64)1 ), ARENA_ALIGNMENT );
+
+	while ( arena->current < arena->blocks.size() )
+	{
+		ArenaBlock &block = arena->blocks[ arena->current ];
+		if ( arena_align( block.used, alignment ) + size <= block.size )
+			break;
+		arena->current += 1;
+	}
+
+	if ( arena->current == arena->blocks.size() )
+	{
+		u64 blockSize = std::max( size + alignment, ARENA_BLOCK_SIZE );
+		u8 *base = (u8*)malloc( blockSize );
+
+		if ( !base )
+			return nullptr;
+
+		arena->blocks.push_back( { base, blockSize, 0 } );
+		arena->reserved += blockSize;
+	}
+
+	ArenaBlock &block = arena->blocks[ arena->current ];
+	u64 offset = arena_align( block.used, alignment );
+
+	arena->last = block.base + offset;
+	arena->lastStart = block.used;
+
+	block.used = offset + size;
+	arena->used += size;
+	arena->peak = std::max( arena->peak, arena->used );
+	arena->allocations += 1;
+	arena->time += std::chrono::steady_clock::now() - start;
+
+	return block.base + offset;
+}
+
+// Grows in place when ptr is the last allocation, stb_image grows its zlib output that way.
+static void *arena_realloc( Arena *arena, void *ptr, u64 oldSize, u64 newSize )
+{
+	if ( !ptr )
+		return arena_alloc( arena, newSize );
+
+	if ( arena->current < arena->blocks.size() )
+	{
+		ArenaBlock &block = arena->blocks[ arena->current ];
+		u64 oldAligned = arena_align( std::max( oldSize, (u64)1 ), ARENA_ALIGNMENT );
+		u64 newAligned = arena_align( std::max( newSize, (u64)1 ), ARENA_ALIGNMENT );
+
+		if ( (u8*)ptr + oldAligned == block.base + block.used && block.used - oldAligned + newAligned <= block.size )
+		{
+			u64 offset = block.used - oldAligned;
+
+			block.used = offset + newAligned;
+			arena->used = arena->used - oldAligned + newAligned;
+			arena->peak = std::max( arena->peak, arena->used );
+			return ptr;
+		}
+	}
+
+	void *result = arena_alloc( arena, newSize );
+
+	if ( result )
+		memcpy( result, ptr, std::min( oldSize, newSize ) );
+
+	return result;
+}
+
+// Rewinds the current block when ptr is the last allocation, anything else stays until the next reset.
+// stb_image frees its scratch buffers right after the allocations that use them, so most of those come back.
+static void arena_release( Arena *arena, void *ptr )
+{
+	if ( !ptr || ptr != arena->last )
+		return;
+
+	ArenaBlock &block = arena->blocks[ arena->current ];
+
+	arena->used -= block.used - ( arena->last - block.base );
+	block.used = arena->lastStart;
+	arena->last = nullptr;
+}
+
+// Copies the name into the arena so it can be used as a string_view key until the next reset.
+static std::string_view arena_intern( Arena *arena, std::string_view name )
+{
+	char *chars = (char*)arena_alloc( arena, name.size(), 1 );
+	memcpy( chars, name.data(), name.size() );
+	return { chars, name.size() };
+}
+
+static void arena_free( Arena *arena )
+{
+	for ( ArenaBlock &block : arena->blocks )
+		free( block.base );
+
+	arena->blocks.clear();
+	arena->current = 0;
+	arena->used = 0;
+	arena->reserved = 0;
+	arena->last = nullptr;
+}
+
+// A group that spilled into several blocks gets one block of the combined size,
+// so the next group of the same size is served from a single block.
+static void arena_reset( Arena *arena )
+{
+	if ( arena->blocks.size() > 1 )
+	{
+		u64 reserved = arena->reserved;
+		arena_free( arena );
+
+		if ( u8 *base = (u8*)malloc( reserved ) )
+		{
+			arena->blocks.push_back( { base, reserved, 0 } );
+			arena->reserved = reserved;
+		}
+	}
+
+	for ( ArenaBlock &block : arena->blocks )
+		block.used = 0;
+
+	arena->current = 0;
+	arena->used = 0;
+	arena->last = nullptr;
+}
+
+// Lets the per group containers allocate from the arena.
+struct ArenaResource : std::pmr::memory_resource
+{
+	Arena *arena;
+
+	explicit ArenaResource( Arena *arena ) : arena( arena ) {}
+
+	void *do_allocate( size_t bytes, size_t alignment ) override
+	{
+		void *ptr = arena_alloc( arena, bytes, std::max( (u64)alignment, ARENA_ALIGNMENT ) );
+		if ( !ptr )
+			throw std::bad_alloc();
+		return ptr;
+	}
+
+	void do_deallocate( void *ptr, [[maybe_unused]] size_t bytes, [[maybe_unused]] size_t alignment ) override
+	{
+		arena_release( arena, ptr );
+	}
+
+	bool do_is_equal( const std::pmr::memory_resource &other ) const noexcept override
+	{
+		return this == &other;
+	}
+};
+
+// Peak resident memory of the process, 0 when it can not be queried.
+static u64 process_peak_memory()
+{
+#if defined( _WIN32 )
+	PROCESS_MEMORY_COUNTERS counters;
+	if ( GetProcessMemoryInfo( GetCurrentProcess(), &counters, sizeof( counters ) ) )
+		return counters.PeakWorkingSetSize;
+	return 0;
+#else
+	struct rusage usage;
+	if ( getrusage( RUSAGE_SELF, &usage ) != 0 )
+		return 0;
+#if defined( __APPLE__ )
+	return (u64)usage.ru_maxrss;
+#else
+	return (u64)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
@@ -0,0 +1,288 @@
+
+#pragma once
+
+// Byte codecs for the texture container.
+// lz_compress writes the LZ4 block format so any LZ4 decoder can read it back.
+// lz_decompress reads it back, the stable layout uses it to find the chunks that did not change.
+// qoi_encode writes a complete QOI image ( https://qoiformat.org ).
+
+static u32 lz_compress_bound( u32 size )
+{
+	return size + size / 255 + 16;
+}
+
+static u32 lz_read32( const u8 *ptr )
+{
+	u32 value;
+	memcpy( &value, ptr, sizeof( value ) );
+	return value;
+}
+
+static u8 *lz_write_length( u8 *op, u32 length )
+{
+	for ( ; length >= 255; length -= 255 )
+		*op++ = 255;
+	*op++ = (u8)length;
+	return op;
+}
+
+// Greedy single probe hash matcher. dst must hold lz_compress_bound( srcSize ) bytes.
+// Returns the compressed size.
+static u32 lz_compress( const u8 *src, u32 srcSize, u8 *dst )
+{
+	constexpr u32 hashBits = 14;
+	constexpr u32 minMatch = 4;
+	constexpr u32 lastLiterals = 5;
+	constexpr u32 matchFindLimit = 12;
+	constexpr u32 maxOffset = 65535;
+
+	std::vector<u32> table( 1 << hashBits, UINT32_MAX );
+
+	u8 *op = dst;
+	u32 anchor = 0;
+	u32 ip = 0;
+
+	auto hash = []( u32 sequence ) { return ( sequence * 2654435761u ) >> ( 32 - hashBits ); };
+
+	while ( srcSize >= matchFindLimit && ip + matchFindLimit <= srcSize )
+	{
+		u32 sequence = lz_read32( src + ip );
+		u32 h = hash( sequence );
+		u32 ref = table[ h ];
+		table[ h ] = ip;
+
+		if ( ref == UINT32_MAX || ip - ref > maxOffset || lz_read32( src + ref ) != sequence )
+		{
+			// skip faster through data that does not compress
+			ip += 1 + ( ( ip - anchor ) >> 6 );
+			continue;
+		}
+
+		u32 matchLength = minMatch;
+		while ( ip + matchLength < srcSize - lastLiterals && src[ ref + matchLength ] == src[ ip + matchLength ] )
+			++matchLength;
+
+		u32 literalLength = ip - anchor;
+		u8 *token = op++;
+		*token = (u8)( ( std::min( literalLength, 15u ) << 4 ) | std::min( matchLength - minMatch, 15u ) );
+
+		if ( literalLength >= 15 )
+			op = lz_write_length( op, literalLength - 15 );
+
+		memcpy( op, src + anchor, literalLength );
+		op += literalLength;
+
+		u16 offset = (u16)( ip - ref );
+		*op++ = (u8)( offset & 0xFF );
+		*op++ = (u8)( offset >> 8 );
+
+		if ( matchLength - minMatch >= 15 )
+			op = lz_write_length( op, matchLength - minMatch - 15 );
+
+		ip += matchLength;
+		anchor = ip;
+	}
+
+	u32 literalLength = srcSize - anchor;
+	*op++ = (u8)( std::min( literalLength, 15u ) << 4 );
+
+	if ( literalLength >= 15 )
+		op = lz_write_length( op, literalLength - 15 );
+
+	memcpy( op, src + anchor, literalLength );
+	op += literalLength;
+
+	return (u32)( op - dst );
+}
+
+// Decodes a block of exactly dstSize bytes, returns false when the block is malformed.
+static bool lz_decompress( const u8 *src, u32 srcSize, u8 *dst, u32 dstSize )
+{
+	constexpr u32 minMatch = 4;
+
+	const u8 *ip = src;
+	const u8 *ipEnd = src + srcSize;
+	u8 *op = dst;
+	u8 *opEnd = dst + dstSize;
+
+	auto read_length = [ &ip, ipEnd ]( u32 &length )
+	{
+		u8 value;
+		do
+		{
+			if ( ip == ipEnd )
+				return false;
+			value = *ip++;
+			length += value;
+		} while ( value == 255 );
+		return true;
+	};
+
+	while ( ip < ipEnd )
+	{
+		u8 token = *ip++;
+
+		u32 literalLength = token >> 4;
+		if ( literalLength == 15 && !read_length( literalLength ) )
+			return false;
+
+		if ( literalLength > (u64)( ipEnd - ip ) || literalLength > (u64)( opEnd - op ) )
+			return false;
+
+		memcpy( op, ip, literalLength );
+		ip += literalLength;
+		op += literalLength;
+
+		// the last sequence is only literals
+		if ( ip == ipEnd )
+			break;
+
+		if ( ipEnd - ip < 2 )
+			return false;
+
+		u32 offset = ip[ 0 ] | ( ip[ 1 ] << 8 );
+		ip += 2;
+
+		u32 matchLength = token & 15;
+		if ( matchLength == 15 && !read_length( matchLength ) )
+			return false;
+		matchLength += minMatch;
+
+		if ( offset == 0 || offset > (u64)( op - dst ) || matchLength > (u64)( opEnd - op ) )
+			return false;
+
+		const u8 *match = op - offset;
+
+		// overlapping matches repeat the bytes just written
+		if ( offset >= matchLength )
+		{
+			memcpy( op, match, matchLength );
+			op += matchLength;
+		}
+		else
+		{
+			for ( u32 i = 0; i < matchLength; ++i )
+				*op++ = match[ i ];
+		}
+	}
+
+	return op == opEnd;
+}
+
+static u64 qoi_encode_bound( i32 width, i32 height )
+{
+	return (u64)width * height * 5 + 14 + 8;
+}
+
+// Encodes 3 or 4 channel pixels, dst must hold qoi_encode_bound bytes. Returns the encoded size.
+static u64 qoi_encode( const u8 *pixels, i32 width, i32 height, u32 channels, u8 *dst )
+{
+	constexpr u8 opIndex = 0x00;
+	constexpr u8 opDiff  = 0x40;
+	constexpr u8 opLuma  = 0x80;
+	constexpr u8 opRun   = 0xC0;
+	constexpr u8 opRGB   = 0xFE;
+	constexpr u8 opRGBA  = 0xFF;
+
+	u8 *op = dst;
+
+	auto write32 = [ &op ]( u32 value )
+	{
+		*op++ = (u8)( value >> 24 );
+		*op++ = (u8)( value >> 16 );
+		*op++ = (u8)( value >> 8 );
+		*op++ = (u8)( value );
+	};
+
+	*op++ = 'q';
+	*op++ = 'o';
+	*op++ = 'i';
+	*op++ = 'f';
+	write32( (u32)width );
+	write32( (u32)height );
+	*op++ = (u8)channels;
+	*op++ = 0; // sRGB with linear alpha
+
+	u8 index[ 64 ][ 4 ] = {};
+	u8 prev[ 4 ] = { 0, 0, 0, 255 };
+	u32 run = 0;
+	u64 pixelCount = (u64)width * height;
+
+	for ( u64 i = 0; i < pixelCount; ++i )
+	{
+		const u8 *src = &pixels[ i * channels ];
+		u8 px[ 4 ];
+		memcpy( px, src, 3 );
+		px[ 3 ] = channels == 4 ? src[ 3 ] : 255;
+
+		if ( memcmp( px, prev, 4 ) == 0 )
+		{
+			++run;
+			if ( run == 62 || i == pixelCount - 1 )
+			{
+				*op++ = opRun | (u8)( run - 1 );
+				run = 0;
+			}
+			continue;
+		}
+
+		if ( run > 0 )
+		{
+			*op++ = opRun | (u8)( run - 1 );
+			run = 0;
+		}
+
+		u32 slot = ( px[ 0 ] * 3 + px[ 1 ] * 5 + px[ 2 ] * 7 + px[ 3 ] * 11 ) % 64;
+
+		if ( memcmp( index[ slot ], px, 4 ) == 0 )
+		{
+			*op++ = opIndex | (u8)slot;
+		}
+		else
+		{
+			memcpy( index[ slot ], px, 4 );
+
+			if ( px[ 3 ] == prev[ 3 ] )
+			{
+				i8 vr = (i8)( px[ 0 ] - prev[ 0 ] );
+				i8 vg = (i8)( px[ 1 ] - prev[ 1 ] );
+				i8 vb = (i8)( px[ 2 ] - prev[ 2 ] );
+				i8 vgr = (i8)( vr - vg );
+				i8 vgb = (i8)( vb - vg );
+
+				if ( vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2 )
+				{
+					*op++ = opDiff | (u8)( ( vr + 2 ) << 4 | ( vg + 2 ) << 2 | ( vb + 2 ) );
+				}
+				else if ( vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8 )
+				{
+					*op++ = opLuma | (u8)( vg + 32 );
+					*op++ = (u8)( ( vgr + 8 ) << 4 | ( vgb + 8 ) );
+				}
+				else
+				{
+					*op++ = opRGB;
+					*op++ = px[ 0 ];
+					*op++ = px[ 1 ];
+					*op++ = px[ 2 ];
+				}
+			}
+			else
+			{
+				*op++ = opRGBA;
+				*op++ = px[ 0 ];
+				*op++ = px[ 1 ];
+				*op++ = px[ 2 ];
+				*op++ = px[ 3 ];
+			}
+		}
+
+		memcpy( prev, px, 4 );
+	}
+
+	for ( i32 i = 0; i < 7; ++i )
+		*op++ = 0;
+	*op++ = 1;
+
+	return (u64)( op - dst );
+}
@@ -10,10 +10,34 @@
 #include <fstream>
 #include <chrono>
 #include <unordered_map>
+#include <map>
+#include <unordered_set>
 #include <climits>
 #include <charconv>
 #include <print>
 #include <string_view>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <memory_resource>
+
+#if defined( _WIN32 )
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || defined( _M_AMD64 )
+#define TEXPACK_SSE2 1
+#include <emmintrin.h>
+#endif
 
 // Third Party Includes
 #pragma warning( push )
@@ -27,9 +51,11 @@
 // Includes
 #include "types.h"
 #include "license.h"
+#include "codec.h"
+#include "arena.h"
 
 const u16 VERSION_MAJOR = 0;
-const u16 VERSION_MINOR = 3;
+const u16 VERSION_MINOR = 14;
 const u16 VERSION_REVISION = 0;
 
 namespace fs = std::filesystem;
@@ -39,23 +65,87 @@ struct App
 	bool verbose;
 	GenCollisionData generateCollisionData;
 	u32 problems;
+	std::string planGroups;		// json objects of the groups packed in plan mode
+	std::string options;		// arguments that change the outputs, shards must agree on them
+	std::vector<std::string> outputFiles;
 };
 
+// Flat open addressing index from a name to a value, linear probing over a power of two table.
+// The names are views of names interned in the group arena, an empty slot has no name.
+struct NameIndex
+{
+	struct Slot
+	{
+		std::string_view name;
+		u32 hash;
+		u32 value;
+	};
+
+	std::pmr::vector<Slot> slots;
+	u32 count;
+};
+
+// Allocated from the group arena. The images only hold what every pass reads, the colliders and
+// mesh vertices of sprite i are pooled at its firstCollider and firstMeshVertex.
+// The index maps are keyed by the interned diffuse name.
 struct Group
 {
-	std::vector<Image> diffuse;
-	std::vector<Image> normal;
-	std::vector<Image> emissive;
+	std::pmr::vector<Image> diffuse;
+	std::pmr::vector<Image> normal;
+	std::pmr::vector<Image> emissive;
+	NameIndex normalIndex;
+	NameIndex emissiveIndex;
+	std::pmr::vector<GenCollisionData> colliders;
+	std::pmr::vector<vec2> meshVertices;
+};
+
+// An atlas holding the sprites routed away from the main texture, written next to it with the suffix.
+struct OutputAtlas
+{
+	std::string suffix;
+	PIXEL_FORMAT pixelFormat;
+	i32 channels;
+	i32 width;
+	i32 height;
+	std::vector<u8> pixels;
+};
+
+// Everything written out for a texture group, or for all the groups of a texture array ( one layer each ).
+struct Output
+{
+	std::string name;
+	bool isArray;
+	std::vector<TexpackSpriteNamed> sprites;
+	std::vector<GenCollisionData> colliders;
+	std::vector<vec2> meshVertices;
+	std::vector<std::vector<u8>> diffuse;
+	std::vector<std::vector<u8>> normal;
+	std::vector<std::vector<u8>> emissive;
+	std::vector<OutputAtlas> atlases;	// sprite atlas 1 is atlases[ 0 ]
+	TexpackGrid grid;					// count is 0 unless the layout is a grid
+};
+
+// Sprites of several groups that a usage file puts together, packed and written like a group called name.
+// The sprites are named group/sprite so the same name in two groups stays apart.
+struct UsagePage
+{
+	std::string name;
+	std::vector<std::string> groups;			// folders of the input the sprites come from
+	std::unordered_set<std::string> sprites;
 };
 
 struct ImageFilesData
 {
-	std::unordered_map<std::string, u64> &map;
 	Group &group;
-	std::vector<stbrp_rect> &rects;
-	std::vector<TexpackSpriteNamed> &texpackSprite;
+	std::pmr::vector<stbrp_rect> &rects;
+	std::pmr::vector<TexpackSpriteNamed> &texpackSprite;
+	std::string prefix;				// put in front of every sprite name
+	const UsagePage *page;			// only the pngs of its sprites are read when set
 };
 
+// Reset at the start of every texture group, stb_image decodes into it as well.
+static Arena groupArena;
+
 enum RESULT_CODE
 {
 	RESULT_CODE_SUCCESS,
@@ -64,9 +154,12 @@ enum RESULT_CODE
 	RESULT_CODE_FAILED_TO_OPEN_DIRECTORY,
 	RESULT_CODE_FAILED_TO_OPEN_IMAGE,
 	RESULT_CODE_FAILED_TO_CREATE_DATA_FILE,
+	RESULT_CODE_FAILED_TO_CREATE_TEXTURE_FILE,
+	RESULT_CODE_FAILED_TO_CREATE_HEADER_FILE,
 	RESULT_CODE_NORMAL_TEXTURE_NOT_SAME_SIZE_AS_DIFFUSE,
 	RESULT_CODE_EMISSIVE_TEXTURE_NOT_SAME_SIZE_AS_DIFFUSE,
 	RESULT_CODE_PROBLEMS_ENCOUNTERED,
+	RESULT_CODE_FAILED_TO_MERGE,
 };
 
 template <>
@@ -88,9 +181,12 @@ struct std::formatter<RESULT_CODE, char>
 		case RESULT_CODE_FAILED_TO_OPEN_DIRECTORY:                   name = "FAILED_TO_OPEN_DIRECTORY"; break;
 		case RESULT_CODE_FAILED_TO_OPEN_IMAGE:                       name = "FAILED_TO_OPEN_IMAGE"; break;
 		case RESULT_CODE_FAILED_TO_CREATE_DATA_FILE:                 name = "FAILED_TO_CREATE_DATA_FILE"; break;
+		case RESULT_CODE_FAILED_TO_CREATE_TEXTURE_FILE:              name = "FAILED_TO_CREATE_TEXTURE_FILE"; break;
+		case RESULT_CODE_FAILED_TO_CREATE_HEADER_FILE:               name = "FAILED_TO_CREATE_HEADER_FILE"; break;
 		case RESULT_CODE_NORMAL_TEXTURE_NOT_SAME_SIZE_AS_DIFFUSE:    name = "NORMAL_TEXTURE_NOT_SAME_SIZE_AS_DIFFUSE"; break;
 		case RESULT_CODE_EMISSIVE_TEXTURE_NOT_SAME_SIZE_AS_DIFFUSE:  name = "EMISSIVE_TEXTURE_NOT_SAME_SIZE_AS_DIFFUSE"; break;
 		case RESULT_CODE_PROBLEMS_ENCOUNTERED:                       name = "RESULT_CODE_PROBLEMS_ENCOUNTERED"; break;
+		case RESULT_CODE_FAILED_TO_MERGE:                            name = "FAILED_TO_MERGE"; break;
 		default:                                                     name = "UNKNOWN"; break;
 		}
 		return std::format_to( ctx.out(), "{} ( {} )", name, static_cast<i32>( code ) );
@@ -109,6 +205,31 @@ struct std::formatter<RESULT_CODE, char>
 		"-m 1                extra space around and not included in the sprite (or --margin) \n"
 		"-p 2                extra space around and included in the sprite (or --pad) \n"
 		"-c                  generate collision box (or --collision) \n"
+		"-r                  allow sprites to be rotated 90 degrees when packing (or --rotate) \n"
+		"-F                  pack each animation frame as its own rect (or --split-frames) \n"
+		"-M 8                generate a convex mesh per sprite with at most this many vertices (or --mesh) \n"
+		"-f png              output texture format, png or tex (or --format) \n"
+		"-z none             tex pixel codec, none, lz4 or qoi (or --codec) \n"
+		"-b                  bundle all layers and the .dat of a group into one tex (or --bundle) \n"
+		"-H                  generate a c++ header with sprite ids and tables (or --header) \n"
+		"-a name=g1,g2       pack the listed groups as layers of one texture array (or --array) \n"
+		"-T 8                alpha within this of 0 or 255 still counts as cutout, 0 to 127 (or --cutout) \n"
+		"-P                  premultiply the diffuse colour by alpha in linear space (or --premultiply) \n"
+		"-d                  fill the colour of transparent texels in and around sprites from their neighbours (or --dilate) \n"
+		"-O                  pack opaque, cutout and blended sprites in separate bands (or --group-opacity) \n"
+		"-R                  move opaque, gray and alpha only sprites into RGB8 and R8 atlases (or --route) \n"
+		"-G                  pack every group as a grid of cells the size of its largest sprite (or --grid) \n"
+		"-x profiles.txt     write every profile of the file into its own folder from one decode (or --profiles) \n"
+		"-u scenes.txt       pack the sprites of the listed groups onto pages by the scenes that draw them (or --usage) \n"
+		"-n                  only read png sizes, pack and write plan.json, no textures (or --plan) \n"
+		"-s 10               keep the previous layout, repack when it needs this % more height (or --stable) \n"
+		"-t 128              write a virtual texture tile pack with tiles of this size (or --tiles) \n"
+		"-g 4                pixels repeated from the neighbours around each tile, default 4 (or --tile-gutter) \n"
+		"-q 16               files read ahead of the decoder, 0 reads each one when it is decoded (or --io-depth) \n"
+		"-C cache.bin        reuse the decoded pixels of unchanged pngs from this file (or --cache) \n"
+		"-S 1/4              build only the groups of shard 1 of 4 and write a shard manifest (or --shard) \n"
+		"-j <output-folder>  check and merge the shard manifests of a sharded build (or --merge) \n"
+		"-B                  benchmark the packers from 1k to 200k rects (or --bench-pack) \n"
 		"-V                  version (or --version) \n"
 		"-v                  verbose logging (or --verbose) \n"
 		"-l                  license (or --license) \n"
@@ -126,6 +247,73 @@ bool to_int( const std::string &str, i32 *result )
 #define min_value( l, r )	( ( l ) < ( r ) ? ( l ) : ( r ) )
 #define max_value( l, r )	( ( l ) > ( r ) ? ( l ) : ( r ) )
 
+// Cheap 64 bit hash to find identical blocks of bytes, equal hashes still need a byte compare.
+static u64 hash_bytes( const u8 *bytes, u64 size )
+{
+	u64 hash = 0x9E3779B97F4A7C15ull ^ size;
+	u64 i = 0;
+
+	for ( ; i + 8 <= size; i += 8 )
+	{
+		u64 word;
+		memcpy( &word, bytes + i, sizeof( word ) );
+		hash = ( hash ^ word ) * 0xFF51AFD7ED558CCDull;
+		hash ^= hash >> 32;
+	}
+
+	for ( ; i < size; ++i )
+		hash = ( hash ^ bytes[ i ] ) * 0x100000001B3ull;
+
+	return hash ^ ( hash >> 29 );
+}
+
+// The slot holding the name, or the empty slot it would go in.
+static u32 name_index_probe( const NameIndex &index, std::string_view name, u32 hash )
+{
+	u32 mask = (u32)index.slots.size() - 1;
+	u32 slot = hash & mask;
+
+	while ( index.slots[ slot ].name.data() && ( index.slots[ slot ].hash != hash || index.slots[ slot ].name != name ) )
+		slot = ( slot + 1 ) & mask;
+
+	return slot;
+}
+
+// UINT32_MAX when the name is not in the index.
+static u32 name_index_find( const NameIndex &index, std::string_view name )
+{
+	if ( index.count == 0 )
+		return UINT32_MAX;
+
+	const NameIndex::Slot &slot = index.slots[ name_index_probe( index, name, (u32)hash_bytes( (const u8*)name.data(), name.size() ) ) ];
+	return slot.name.data() ? slot.value : UINT32_MAX;
+}
+
+// The name must stay alive as long as the index, a name seen again takes the new value.
+static void name_index_set( NameIndex *index, std::string_view name, u32 value )
+{
+	// kept at most half full so the probes stay short
+	if ( ( index->count + 1 ) * 2 > index->slots.size() )
+	{
+		std::pmr::vector<NameIndex::Slot> previous( max_value( index->slots.size() * 2, (u64)16 ), index->slots.get_allocator() );
+		previous.swap( index->slots );
+
+		for ( const NameIndex::Slot &slot : previous )
+		{
+			if ( slot.name.data() )
+				index->slots[ name_index_probe( *index, slot.name, slot.hash ) ] = slot;
+		}
+	}
+
+	u32 hash = (u32)hash_bytes( (const u8*)name.data(), name.size() );
+	NameIndex::Slot &slot = index->slots[ name_index_probe( *index, name, hash ) ];
+
+	if ( !slot.name.data() )
+		index->count += 1;
+
+	slot = { name, hash, value };
+}
+
 static i32 image_rect_area_left( Image *image, i32 left, i32 imgWidth, i32 frameCount )
 {
 	i32 frameW = image->frameW;
@@ -223,6 +411,19 @@ static ivec4 image_rect_area( Image *image, TexpackSpriteNamed *sprite, i32 imgW
 	ivec4 area = { INT32_MIN, INT32_MIN, INT32_MAX, INT32_MAX };
 	i32 frameCount = sprite->sprite.frameCount;
 
+	// a single frame is the whole image, the cached bounds are the answer
+	if ( frameCount == 1 && image->alpha.known && image->alpha.bounds.x <= image->alpha.bounds.z )
+	{
+		area = image->alpha.bounds;
+
+		area.x += image->padding;
+		area.y += image->padding;
+		area.z += image->padding;
+		area.w += image->padding;
+
+		return area;
+	}
+
 	area.x = image_rect_area_left( image, area.x, imgWidth , frameCount);
 	area.y = image_rect_area_top( image, area.y, imgWidth, frameCount );
 	area.z = image_rect_area_right( image, area.z, imgWidth, frameCount );
@@ -236,682 +437,5875 @@ static ivec4 image_rect_area( Image *image, TexpackSpriteNamed *sprite, i32 imgW
 	return area;
 }
 
-static bool render_image( std::vector<u8> &output, i32 offX, i32 offY, i32 frameW, i32 frameH, u8 *input, i32 imgSize, i32 frame, i32 inputW, i32 channels, Data *data )
+// Sets bit ( x & 63 ) of word ( x >> 6 ) for every pixel with alpha >= threshold, rows are 64 bit aligned.
+// The mask covers the padded frame, so the bits line up with the sprite size and colliders.
+static void image_collision_mask( Image *image, GenCollisionData *colData, i32 imgWidth, i32 frameCount )
 {
-	bool isTranslucent = false;
+	i32 frameW = image->frameW;
+	i32 frameH = image->frameH;
+	i32 padding = image->padding;
+	u8 *input = image->img;
+	u8 threshold = (u8)min_value( max_value( colData->threshold, 1 ), 255 );
 
-	for ( i32 y = 0; y < frameH; ++y )
+	i32 maskW = frameW + padding * 2;
+	i32 maskH = frameH + padding * 2;
+	i32 wordsPerRow = ( maskW + 63 ) / 64;
+
+	colData->maskSize = { maskW, maskH };
+	colData->mask.assign( (u64)wordsPerRow * maskH * frameCount, 0 );
+
+	auto set_bits = []( u64 *row, i32 bit, u64 bits, i32 count )
 	{
-		for ( i32 x = 0; x < frameW; ++x )
+		row[ bit >> 6 ] |= bits << ( bit & 63 );
+		if ( ( bit & 63 ) + count > 64 )
+			row[ ( bit >> 6 ) + 1 ] |= bits >> ( 64 - ( bit & 63 ) );
+	};
+
+#ifdef TEXPACK_SSE2
+	const __m128i thresholdV = _mm_set1_epi8( (char)threshold );
+#endif
+
+	for ( i32 frame = 0; frame < frameCount; ++frame )
+	{
+		for ( i32 y = 0; y < frameH; ++y )
+		{
+			u64 *row = &colData->mask[ ( (u64)frame * maskH + y + padding ) * wordsPerRow ];
+			const u8 *src = &input[ ( frame * frameW + y * imgWidth ) * 4 ];
+			i32 x = 0;
+
+#ifdef TEXPACK_SSE2
+			// 16 pixels at a time, shift the alpha down, pack to bytes then compare and movemask
+			for ( ; x + 16 <= frameW; x += 16 )
+			{
+				__m128i p0 = _mm_srli_epi32( _mm_loadu_si128( (const __m128i*)( src + x * 4 + 0 ) ), 24 );
+				__m128i p1 = _mm_srli_epi32( _mm_loadu_si128( (const __m128i*)( src + x * 4 + 16 ) ), 24 );
+				__m128i p2 = _mm_srli_epi32( _mm_loadu_si128( (const __m128i*)( src + x * 4 + 32 ) ), 24 );
+				__m128i p3 = _mm_srli_epi32( _mm_loadu_si128( (const __m128i*)( src + x * 4 + 48 ) ), 24 );
+				__m128i alpha = _mm_packus_epi16( _mm_packs_epi32( p0, p1 ), _mm_packs_epi32( p2, p3 ) );
+				__m128i pass = _mm_cmpeq_epi8( _mm_max_epu8( alpha, thresholdV ), alpha );
+				u64 bits = (u32)_mm_movemask_epi8( pass );
+				if ( bits )
+					set_bits( row, x + padding, bits, 16 );
+			}
+#endif
+
+			for ( ; x < frameW; ++x )
+			{
+				if ( src[ x * 4 + 3 ] >= threshold )
+					set_bits( row, x + padding, 1, 1 );
+			}
+		}
+	}
+}
+
+// Classifies each frame by its alpha. Alpha within tolerance of 0 or 255 is treated as hard,
+// so a frame of only 255 is opaque, only hard values is cutout and anything else must blend.
+// Padding is transparent in the atlas, so a padded frame is never better than cutout.
+static OPACITY image_opacity( Image *image, i32 imgWidth, i32 frameCount, i32 tolerance, std::vector<u8> &frameOpacity )
+{
+	i32 frameW = image->frameW;
+	i32 frameH = image->frameH;
+	u8 *input = image->img;
+	u8 low = (u8)min_value( max_value( tolerance, 0 ), 127 );
+	u8 high = (u8)( 255 - low );
+
+	OPACITY opacity = OPACITY_OPAQUE;
+	frameOpacity.assign( frameCount, OPACITY_OPAQUE );
+
+	if ( image->alpha.known && image->alpha.opaque )
+	{
+		opacity = image->padding == 0 ? OPACITY_OPAQUE : OPACITY_CUTOUT;
+		frameOpacity.assign( frameCount, opacity );
+		return opacity;
+	}
+
+#ifdef TEXPACK_SSE2
+	const __m128i lowV = _mm_set1_epi8( (char)low );
+	const __m128i highV = _mm_set1_epi8( (char)high );
+	const __m128i opaqueV = _mm_set1_epi8( (char)255 );
+#endif
+
+	for ( i32 frame = 0; frame < frameCount; ++frame )
+	{
+		bool allOpaque = true;
+		bool allHard = true;
+
+		for ( i32 y = 0; y < frameH && allHard; ++y )
 		{
-			i32 to = ( ( offX + x ) + ( offY + y ) * data->textureWidth ) * data->outputChannels;
-			i32 from = ( x + frame * frameW + y * inputW ) * channels;
+			const u8 *src = &input[ ( frame * frameW + y * imgWidth ) * 4 ];
+			i32 x = 0;
 
-			output[ to + 0 ] = input[ from + 0 ];
-			output[ to + 1 ] = input[ from + 1 ];
-			output[ to + 2 ] = input[ from + 2 ];
-			output[ to + 3 ] = input[ from + 3 ];
+#ifdef TEXPACK_SSE2
+			// 16 alphas at a time, same shift and pack as the collision mask
+			for ( ; x + 16 <= frameW; x += 16 )
+			{
+				__m128i p0 = _mm_srli_epi32( _mm_loadu_si128( (const __m128i*)( src + x * 4 + 0 ) ), 24 );
+				__m128i p1 = _mm_srli_epi32( _mm_loadu_si128( (const __m128i*)( src + x * 4 + 16 ) ), 24 );
+				__m128i p2 = _mm_srli_epi32( _mm_loadu_si128( (const __m128i*)( src + x * 4 + 32 ) ), 24 );
+				__m128i p3 = _mm_srli_epi32( _mm_loadu_si128( (const __m128i*)( src + x * 4 + 48 ) ), 24 );
+				__m128i alpha = _mm_packus_epi16( _mm_packs_epi32( p0, p1 ), _mm_packs_epi32( p2, p3 ) );
+				__m128i isLow = _mm_cmpeq_epi8( _mm_min_epu8( alpha, lowV ), alpha );
+				__m128i isHigh = _mm_cmpeq_epi8( _mm_max_epu8( alpha, highV ), alpha );
+
+				allOpaque = allOpaque && _mm_movemask_epi8( _mm_cmpeq_epi8( alpha, opaqueV ) ) == 0xFFFF;
+				allHard = allHard && _mm_movemask_epi8( _mm_or_si128( isLow, isHigh ) ) == 0xFFFF;
+			}
+#endif
 
-			isTranslucent = isTranslucent || ( output[ to + 3 ] != 0 && output[ to + 3 ] != 255 );
+			for ( ; x < frameW; ++x )
+			{
+				u8 alpha = src[ x * 4 + 3 ];
+				allOpaque = allOpaque && alpha == 255;
+				allHard = allHard && ( alpha <= low || alpha >= high );
+			}
 		}
+
+		OPACITY frameClass = !allHard ? OPACITY_BLEND : ( allOpaque && image->padding == 0 ? OPACITY_OPAQUE : OPACITY_CUTOUT );
+		frameOpacity[ frame ] = frameClass;
+		opacity = max_value( opacity, frameClass );
 	}
 
-	return isTranslucent;
+	return opacity;
 }
 
-RESULT_CODE image_files( const char *path, App *app, Data *data, ImageFilesData *fileData )
+// Convex outline around every non transparent pixel of all frames, in the padded sprite space.
+// The hull is then reduced to maxVertices by removing the edge whose neighbours extended
+// to meet add the least area, so the mesh only ever grows and never cuts into the sprite.
+static void image_outline_mesh( Image *image, i32 imgWidth, i32 frameCount, i32 maxVertices, std::vector<vec2> &vertices )
 {
-	RESULT_CODE ret = RESULT_CODE_SUCCESS;
+	struct Point
+	{
+		f64 x;
+		f64 y;
+	};
 
-	fs::path entrypath;
-	std::string filepath;
-	std::string filename;
-	std::string datafilename;
-	std::ifstream datafile;
-	std::string datafileField;
-	i32 frameCount;
-	i32 margin;
-	i32 padding;
-	i32 originX;
-	i32 originY;
-	i32 imgWidth;
-	i32 imgHeight;
-	u16 nineslice;
-	bool manualCol;
-	u32 collisionCount;
-	GenCollisionData genColData[ MAX_SPRITE_COLLIDERS ];
+	i32 frameW = image->frameW;
+	i32 frameH = image->frameH;
+	u8 *input = image->img;
 
-	filepath.reserve( 1024 );
-	filename.reserve( 1024 );
-	datafilename.reserve( 1024 );
-	datafileField.reserve( 1024 );
+	auto cross = []( Point o, Point a, Point b )
+	{
+		return ( a.x - o.x ) * ( b.y - o.y ) - ( a.y - o.y ) * ( b.x - o.x );
+	};
 
-	for ( const fs::directory_entry &entry : fs::recursive_directory_iterator( path ) )
+	// pixel corners of the outermost pixel in each row
+	std::vector<Point> points;
+	points.reserve( frameH * 4 );
+
+	for ( i32 y = 0; y < frameH; ++y )
 	{
-		if ( entry.is_directory() )
-			continue;
+		i32 left = INT32_MAX;
+		i32 right = INT32_MIN;
 
-		entrypath = entry.path();
+		for ( i32 frame = 0; frame < frameCount; ++frame )
+		{
+			const u8 *row = &input[ ( frame * frameW + y * imgWidth ) * 4 ];
 
-		if ( entrypath.extension() == ".txt" )
+			for ( i32 x = 0; x < min_value( left, frameW ); ++x )
+			{
+				if ( row[ x * 4 + 3 ] != 0 )
+				{
+					left = x;
+					break;
+				}
+			}
+
+			for ( i32 x = frameW - 1; x > right; --x )
+			{
+				if ( row[ x * 4 + 3 ] != 0 )
+				{
+					right = x;
+					break;
+				}
+			}
+		}
+
+		if ( left > right )
 			continue;
 
-		auto fp = entrypath.u8string();
-		auto fn = entrypath.stem().u8string();
+		points.push_back( { (f64)left, (f64)y } );
+		points.push_back( { (f64)left, (f64)y + 1 } );
+		points.push_back( { (f64)right + 1, (f64)y } );
+		points.push_back( { (f64)right + 1, (f64)y + 1 } );
+	}
 
-		filepath.assign( reinterpret_cast<const char*>( fp.data() ), fp.size() );
-		filename.assign( reinterpret_cast<const char*>( fn.data() ), fn.size() );
+	vertices.clear();
 
-		if ( app->verbose )
-			std::println( "Processing file: {}", filepath );
+	if ( points.empty() )
+		return;
 
-		frameCount = -1;
-		margin = data->margin;
-		padding = data->padding;
-		originX = INT32_MAX;
-		originY = INT32_MAX;
-		nineslice = 0;
-		collisionCount = app->generateCollisionData.enable ? 1 : 0;
-		genColData[ 0 ] = app->generateCollisionData;
-		manualCol = false;
+	std::sort( points.begin(), points.end(), []( const Point &l, const Point &r ) { return l.x < r.x || ( l.x == r.x && l.y < r.y ); } );
 
-		Image *image = nullptr;
+	// monotone chain
+	std::vector<Point> hull( points.size() * 2 );
+	i32 count = 0;
 
-		if ( filename.length() > 1 && filename.back() == 'n' && filename[ filename.length() - 2 ] == '_' )
+	for ( i32 i = 0; i < (i32)points.size(); ++i )
+	{
+		while ( count >= 2 && cross( hull[ count - 2 ], hull[ count - 1 ], points[ i ] ) <= 0 )
+			--count;
+		hull[ count++ ] = points[ i ];
+	}
+
+	for ( i32 i = (i32)points.size() - 2, lower = count + 1; i >= 0; --i )
+	{
+		while ( count >= lower && cross( hull[ count - 2 ], hull[ count - 1 ], points[ i ] ) <= 0 )
+			--count;
+		hull[ count++ ] = points[ i ];
+	}
+
+	hull.resize( count - 1 );
+
+	while ( (i32)hull.size() > maxVertices )
+	{
+		i32 n = (i32)hull.size();
+		i32 best = -1;
+		f64 bestArea = 0;
+		Point bestPoint = {};
+
+		for ( i32 i = 0; i < n; ++i )
 		{
-			fileData->map[ filename ] = fileData->group.normal.size();
-			fileData->group.normal.emplace_back();
-			image = &fileData->group.normal.back();
-			image->filename = filename;
-			image->img = stbi_load( filepath.c_str(), &image->width, &image->height, &image->channels, 4 );
-			image->imgSize = image->width * image->height * image->channels;
+			Point p = hull[ ( i + n - 1 ) % n ];
+			Point a = hull[ i ];
+			Point b = hull[ ( i + 1 ) % n ];
+			Point q = hull[ ( i + 2 ) % n ];
+
+			Point d1 = { a.x - p.x, a.y - p.y };
+			Point d2 = { q.x - b.x, q.y - b.y };
+			f64 denom = d1.x * d2.y - d1.y * d2.x;
+
+			// the neighbouring edges have to converge past the removed edge
+			if ( denom <= 1e-9 )
+				continue;
+
+			f64 t = ( ( b.x - a.x ) * d2.y - ( b.y - a.y ) * d2.x ) / denom;
+			Point meet = { a.x + t * d1.x, a.y + t * d1.y };
+
+			if ( meet.x < -1e-6 || meet.y < -1e-6 || meet.x > frameW + 1e-6 || meet.y > frameH + 1e-6 )
+				continue;
+
+			f64 area = fabs( cross( a, meet, b ) ) * 0.5;
+
+			if ( best == -1 || area < bestArea )
+			{
+				best = i;
+				bestArea = area;
+				bestPoint = meet;
+			}
 		}
-		else if ( filename.length() > 1 && filename.back() == 'e' && filename[ filename.length() - 2 ] == '_' )
+
+		if ( best == -1 )
+			break;
+
+		hull[ best ] = bestPoint;
+		hull.erase( hull.begin() + ( best + 1 ) % n );
+	}
+
+	if ( (i32)hull.size() > maxVertices )
+	{
+		Point minP = hull[ 0 ];
+		Point maxP = hull[ 0 ];
+
+		for ( const Point &pt : hull )
 		{
-			fileData->map[ filename ] = fileData->group.emissive.size();
-			fileData->group.emissive.emplace_back();
-			image = &fileData->group.emissive.back();
-			image->filename = filename;
-			image->img = stbi_load( filepath.c_str(), &image->width, &image->height, &image->channels, 4 );
-			image->imgSize = image->width * image->height * image->channels;
+			minP = { min_value( minP.x, pt.x ), min_value( minP.y, pt.y ) };
+			maxP = { max_value( maxP.x, pt.x ), max_value( maxP.y, pt.y ) };
 		}
-		else
+
+		hull = { minP, { minP.x, maxP.y }, maxP, { maxP.x, minP.y } };
+	}
+
+	vertices.reserve( hull.size() );
+
+	for ( const Point &pt : hull )
+		vertices.push_back( { (f32)( pt.x + image->padding ), (f32)( pt.y + image->padding ) } );
+}
+
+// Copies the rows of the frame that land in [ rowBegin, rowEnd ) of the output.
+static void render_image( std::vector<u8> &output, i32 offX, i32 offY, i32 frameW, i32 frameH, const u8 *input, i32 frame, i32 inputW, i32 channels, i32 rowBegin, i32 rowEnd, Data *data )
+{
+	i32 beginY = max_value( rowBegin - offY, 0 );
+	i32 endY = min_value( rowEnd - offY, frameH );
+
+	for ( i32 y = beginY; y < endY; ++y )
+	{
+		u64 to = ( (u64)offX + (u64)( offY + y ) * data->textureWidth ) * data->outputChannels;
+		u64 from = ( (u64)frame * frameW + (u64)y * inputW ) * channels;
+
+		if ( channels == 4 )
 		{
-			if ( frameCount == -1 )
-			{
-				frameCount = 1;
+			memcpy( &output[ to ], &input[ from ], (u64)frameW * 4 );
+			continue;
+		}
 
-				size_t found = filename.rfind( "_" );
+		for ( i32 x = 0; x < frameW; ++x )
+		{
+			output[ to + x * 4 + 0 ] = input[ from + x * channels + 0 ];
+			output[ to + x * 4 + 1 ] = input[ from + x * channels + 1 ];
+			output[ to + x * 4 + 2 ] = input[ from + x * channels + 2 ];
+			output[ to + x * 4 + 3 ] = input[ from + x * channels + 3 ];
+		}
+	}
+}
 
-				if ( found != std::string::npos )
+// Writes the frame transposed, input ( x, y ) lands at output ( offX + y, offY + x ), again only
+// the output rows [ rowBegin, rowEnd ). Walks in square blocks so both the reads and the column
+// writes stay within a few cache lines.
+static void render_image_transposed( std::vector<u8> &output, i32 offX, i32 offY, i32 frameW, i32 frameH, const u8 *input, i32 frame, i32 inputW, i32 channels, i32 rowBegin, i32 rowEnd, Data *data )
+{
+	constexpr i32 blockSize = 16;
+
+	i32 beginX = max_value( rowBegin - offY, 0 );
+	i32 endX = min_value( rowEnd - offY, frameW );
+
+	for ( i32 by = 0; by < frameH; by += blockSize )
+	{
+		i32 endY = min_value( by + blockSize, frameH );
+
+		for ( i32 bx = beginX; bx < endX; bx += blockSize )
+		{
+			i32 blockEndX = min_value( bx + blockSize, endX );
+
+			for ( i32 x = bx; x < blockEndX; ++x )
+			{
+				for ( i32 y = by; y < endY; ++y )
 				{
-					if ( to_int( &filename[ found + 1 ], &frameCount ) )
-					{
-						filename.erase( found );
-					}
+					u64 to = ( (u64)( offX + y ) + (u64)( offY + x ) * data->textureWidth ) * data->outputChannels;
+					u64 from = ( (u64)x + (u64)frame * frameW + (u64)y * inputW ) * channels;
+
+					output[ to + 0 ] = input[ from + 0 ];
+					output[ to + 1 ] = input[ from + 1 ];
+					output[ to + 2 ] = input[ from + 2 ];
+					output[ to + 3 ] = input[ from + 3 ];
 				}
 			}
+		}
+	}
+}
 
-			auto df = ( entrypath.parent_path() / filename ).replace_extension( "txt" ).u8string();
-			datafilename.assign( reinterpret_cast<const char*>( df.data() ), df.size() );
+// render_image for 4 channel frames of a tile width known at compile time,
+// the row copy becomes a few vector moves instead of a memcpy call.
+// frameW and channels are FrameW and 4, they stay in the signature so both fit RenderFunc.
+template <i32 FrameW>
+static void render_image_fixed( std::vector<u8> &output, i32 offX, i32 offY, [[maybe_unused]] i32 frameW, i32 frameH, const u8 *input, i32 frame, i32 inputW, [[maybe_unused]] i32 channels, i32 rowBegin, i32 rowEnd, Data *data )
+{
+	i32 beginY = max_value( rowBegin - offY, 0 );
+	i32 endY = min_value( rowEnd - offY, frameH );
 
-			datafile.open( datafilename, std::ios::binary );
+	for ( i32 y = beginY; y < endY; ++y )
+	{
+		u64 to = ( (u64)offX + (u64)( offY + y ) * data->textureWidth ) * 4;
+		u64 from = ( (u64)frame * FrameW + (u64)y * inputW ) * 4;
 
-			if ( datafile )
-			{
-				if ( app->verbose )
-					std::println( "Reading datafile: {}", datafilename );
+		memcpy( &output[ to ], &input[ from ], FrameW * 4 );
+	}
+}
 
-				while ( !datafile.eof() && datafile.good() )
-				{
-					datafile >> datafileField;
+using RenderFunc = void (*)( std::vector<u8>&, i32, i32, i32, i32, const u8*, i32, i32, i32, i32, i32, Data* );
 
-					if ( datafileField == "FC" )
-					{
-						datafile >> frameCount;
-					}
-					else if ( datafileField == "MG" )
-					{
-						datafile >> margin;
-					}
-					else if ( datafileField == "PD" )
-					{
-						datafile >> padding;
-					}
-					else if ( datafileField == "OR" )
-					{
-						datafile >> originX;
-						datafile >> originY;
-					}
-					else if ( datafileField == "NS" )
-					{
-						i32 value;
-						datafile >> value;
-						if ( value < 0 || value > 65535 )
-						{
-							std::println( stderr, "Nineslice value out of bounds: {} (max is 65535)", value );
-							value = 0;
-						}
-						nineslice = (u16)value;
-					}
-					else if ( datafileField == "COL" )
+static RenderFunc render_image_for( i32 frameW, i32 channels )
+{
+	if ( channels != 4 )
+		return render_image;
+
+	switch ( frameW )
+	{
+	case 8:		return render_image_fixed<8>;
+	case 16:	return render_image_fixed<16>;
+	case 32:	return render_image_fixed<32>;
+	case 64:	return render_image_fixed<64>;
+	default:	return render_image;
+	}
+}
+
+// Any alpha other than 0 or 255 in the frame.
+static bool image_frame_translucent( const Image *image, i32 frame, i32 frameW, i32 frameH, i32 inputW )
+{
+	if ( image->alpha.known && !image->alpha.translucent )
+		return false;
+
+	for ( i32 y = 0; y < frameH; ++y )
+	{
+		const u8 *src = &image->img[ ( (u64)frame * frameW + (u64)y * inputW ) * image->channels ];
+
+		for ( i32 x = 0; x < frameW; ++x )
+		{
+			u8 alpha = src[ x * image->channels + 3 ];
+			if ( alpha != 0 && alpha != 255 )
+				return true;
+		}
+	}
+
+	return false;
+}
+
+// Writes the 4 byte pixel count times, doubling the copied run each step.
+static void fill_pixels( u8 *dst, u64 count, const u8 pixel[ 4 ] )
+{
+	if ( count == 0 )
+		return;
+
+	memcpy( dst, pixel, 4 );
+
+	for ( u64 filled = 1; filled < count; )
+	{
+		u64 copy = min_value( filled, count - filled );
+		memcpy( dst + filled * 4, dst, copy * 4 );
+		filled += copy;
+	}
+}
+
+template <typename Func>
+static void parallel_for( u32 count, Func &&func )
+{
+	u32 threadCount = min_value( max_value( std::thread::hardware_concurrency(), 1u ), count );
+
+	if ( threadCount <= 1 )
+	{
+		for ( u32 i = 0; i < count; ++i )
+			func( i );
+		return;
+	}
+
+	std::atomic<u32> next = 0;
+	std::vector<std::thread> threads;
+	threads.reserve( threadCount );
+
+	for ( u32 t = 0; t < threadCount; ++t )
+	{
+		threads.emplace_back( [ &next, &func, count ]()
+		{
+			for ( u32 i = next++; i < count; i = next++ )
+				func( i );
+		} );
+	}
+
+	for ( std::thread &thread : threads )
+		thread.join();
+}
+
+// Exact squared distance transform of one row or column ( Felzenszwalb and Huttenlocher, lower envelope of parabolas ).
+// f is 0 at features and huge elsewhere, d gets the squared distance to the nearest feature and nearest its position.
+// v and z are scratch for n and n + 1 values.
+static void distance_transform_1d( const f64 *f, i32 n, f64 *d, i32 *nearest, i32 *v, f64 *z )
+{
+	constexpr f64 infinity = 1e30;
+
+	i32 k = 0;
+	v[ 0 ] = 0;
+	z[ 0 ] = -infinity;
+	z[ 1 ] = infinity;
+
+	for ( i32 q = 1; q < n; ++q )
+	{
+		f64 s;
+
+		// z[ 0 ] is -infinity so k never drops below 0
+		for ( ;; --k )
+		{
+			s = ( ( f[ q ] + (f64)q * q ) - ( f[ v[ k ] ] + (f64)v[ k ] * v[ k ] ) ) / ( 2.0 * q - 2.0 * v[ k ] );
+			if ( s > z[ k ] )
+				break;
+		}
+
+		++k;
+		v[ k ] = q;
+		z[ k ] = s;
+		z[ k + 1 ] = infinity;
+	}
+
+	k = 0;
+
+	for ( i32 q = 0; q < n; ++q )
+	{
+		while ( z[ k + 1 ] < q )
+			++k;
+
+		d[ q ] = (f64)( q - v[ k ] ) * ( q - v[ k ] ) + f[ v[ k ] ];
+		nearest[ q ] = v[ k ];
+	}
+}
+
+// Squared distance from every cell to the nearest cell where feature is set, and the index of that cell.
+// Columns then rows, each pass split across threads in blocks of lines.
+static void distance_transform( const std::vector<u8> &feature, i32 w, i32 h, std::vector<f64> &dist, std::vector<u32> &nearest )
+{
+	constexpr f64 infinity = 1e20;
+	constexpr i32 blockLines = 64;
+
+	std::vector<f64> columnDist( (u64)w * h );
+	std::vector<i32> columnNearest( (u64)w * h );
+
+	dist.resize( (u64)w * h );
+	nearest.resize( (u64)w * h );
+
+	// small sprites are not worth starting threads for
+	auto run = [ w, h ]( i32 lines, auto &&pass )
+	{
+		u32 blocks = (u32)( ( lines + blockLines - 1 ) / blockLines );
+
+		if ( (u64)w * h < 256 * 256 )
+		{
+			for ( u32 block = 0; block < blocks; ++block )
+				pass( block );
+		}
+		else
+		{
+			parallel_for( blocks, pass );
+		}
+	};
+
+	run( w, [ & ]( u32 block )
+	{
+		i32 n = h;
+		std::vector<f64> f( n ), d( n ), z( n + 1 );
+		std::vector<i32> v( n ), closest( n );
+
+		for ( i32 x = (i32)block * blockLines, end = min_value( x + blockLines, w ); x < end; ++x )
+		{
+			for ( i32 y = 0; y < h; ++y )
+				f[ y ] = feature[ (u64)y * w + x ] ? 0.0 : infinity;
+
+			distance_transform_1d( f.data(), n, d.data(), closest.data(), v.data(), z.data() );
+
+			for ( i32 y = 0; y < h; ++y )
+			{
+				columnDist[ (u64)y * w + x ] = d[ y ];
+				columnNearest[ (u64)y * w + x ] = closest[ y ];
+			}
+		}
+	} );
+
+	run( h, [ & ]( u32 block )
+	{
+		i32 n = w;
+		std::vector<f64> z( n + 1 );
+		std::vector<i32> v( n ), closest( n );
+
+		for ( i32 y = (i32)block * blockLines, end = min_value( y + blockLines, h ); y < end; ++y )
+		{
+			u64 row = (u64)y * w;
+
+			distance_transform_1d( &columnDist[ row ], n, &dist[ row ], closest.data(), v.data(), z.data() );
+
+			for ( i32 x = 0; x < w; ++x )
+				nearest[ row + x ] = (u32)( columnNearest[ row + closest[ x ] ] * w + closest[ x ] );
+		}
+	} );
+}
+
+// Replaces every frame with a signed distance field of its alpha, 128 on the edge and 0 or 255 at spread pixels
+// outside or inside. The frames grow by spread on every side so the field is not cut off, then they are averaged
+// down by downscale. Outside the shape the colour of the nearest inside pixel is repeated so filtering has no fringe.
+// Without pixels ( plan mode ) only the size changes.
+static void image_sdf( Image *image, i32 frameCount, i32 spread, i32 downscale )
+{
+	i32 frameW = image->width / frameCount;
+	i32 frameH = image->height;
+	i32 gridW = frameW + spread * 2;
+	i32 gridH = frameH + spread * 2;
+	i32 outFrameW = ( gridW + downscale - 1 ) / downscale;
+	i32 outH = ( gridH + downscale - 1 ) / downscale;
+	i32 outW = outFrameW * frameCount;
+
+	if ( image->img )
+	{
+		u8 *out = (u8*)arena_alloc( &groupArena, (u64)outW * outH * 4 );
+
+		std::vector<u8> inside( (u64)gridW * gridH );
+		std::vector<u8> outside( (u64)gridW * gridH );
+		std::vector<f64> toInside, toOutside;
+		std::vector<u32> nearestInside, nearestOutside;
+		std::vector<f32> field( (u64)gridW * gridH );
+
+		for ( i32 frame = 0; frame < frameCount; ++frame )
+		{
+			auto source = [ &, frame ]( i32 gx, i32 gy ) -> const u8*
+			{
+				i32 x = gx - spread;
+				i32 y = gy - spread;
+				if ( x < 0 || y < 0 || x >= frameW || y >= frameH )
+					return nullptr;
+				return &image->img[ ( (u64)y * image->width + frame * frameW + x ) * 4 ];
+			};
+
+			for ( i32 gy = 0; gy < gridH; ++gy )
+			{
+				for ( i32 gx = 0; gx < gridW; ++gx )
+				{
+					const u8 *px = source( gx, gy );
+					u64 cell = (u64)gy * gridW + gx;
+					inside[ cell ] = px && px[ 3 ] >= 128;
+					outside[ cell ] = !inside[ cell ];
+				}
+			}
+
+			distance_transform( inside, gridW, gridH, toInside, nearestInside );
+			distance_transform( outside, gridW, gridH, toOutside, nearestOutside );
+
+			// distances are between pixel centres, the edge is half a pixel from both sides
+			for ( u64 cell = 0, count = field.size(); cell < count; ++cell )
+				field[ cell ] = inside[ cell ] ? (f32)sqrt( toOutside[ cell ] ) - 0.5f : 0.5f - (f32)sqrt( toInside[ cell ] );
+
+			bool anyInside = std::find( inside.begin(), inside.end(), (u8)1 ) != inside.end();
+
+			for ( i32 oy = 0; oy < outH; ++oy )
+			{
+				for ( i32 ox = 0; ox < outFrameW; ++ox )
+				{
+					i32 gx0 = ox * downscale;
+					i32 gy0 = oy * downscale;
+					i32 gx1 = min_value( gx0 + downscale, gridW );
+					i32 gy1 = min_value( gy0 + downscale, gridH );
+
+					f32 sum = 0.0f;
+					for ( i32 gy = gy0; gy < gy1; ++gy )
+						for ( i32 gx = gx0; gx < gx1; ++gx )
+							sum += field[ (u64)gy * gridW + gx ];
+
+					f32 distance = sum / (f32)( ( gx1 - gx0 ) * ( gy1 - gy0 ) );
+					f32 alpha = 127.5f + distance / (f32)spread * 127.5f;
+
+					u64 centre = (u64)( ( gy0 + gy1 ) / 2 ) * gridW + ( gx0 + gx1 ) / 2;
+					const u8 *colour = nullptr;
+
+					if ( inside[ centre ] )
+						colour = source( (i32)( centre % gridW ), (i32)( centre / gridW ) );
+					else if ( anyInside )
+						colour = source( (i32)( nearestInside[ centre ] % gridW ), (i32)( nearestInside[ centre ] / gridW ) );
+
+					u8 *dst = &out[ ( (u64)oy * outW + frame * outFrameW + ox ) * 4 ];
+					dst[ 0 ] = colour ? colour[ 0 ] : 0;
+					dst[ 1 ] = colour ? colour[ 1 ] : 0;
+					dst[ 2 ] = colour ? colour[ 2 ] : 0;
+					dst[ 3 ] = (u8)min_value( max_value( alpha + 0.5f, 0.0f ), 255.0f );
+				}
+			}
+		}
+
+		image->img = out;
+	}
+
+	image->width = outW;
+	image->height = outH;
+	image->channels = 4;
+	image->imgSize = outW * outH * 4;
+	image->alpha.known = false;
+}
+
+// Averages every frame down by scale for a smaller profile. The colour is weighted by alpha so the
+// transparent pixels around a shape do not darken its edge. Frames are cut to a multiple of scale.
+// Without pixels ( plan mode ) only the size changes.
+static void image_downscale( Image *image, i32 frameCount, i32 scale )
+{
+	i32 frameW = image->width / frameCount;
+	i32 outFrameW = max_value( frameW / scale, 1 );
+	i32 outH = max_value( image->height / scale, 1 );
+	i32 outW = outFrameW * frameCount;
+
+	if ( image->img )
+	{
+		u8 *out = (u8*)arena_alloc( &groupArena, (u64)outW * outH * 4 );
+
+		for ( i32 oy = 0; oy < outH; ++oy )
+		{
+			i32 y0 = oy * scale;
+			i32 y1 = min_value( y0 + scale, image->height );
+
+			for ( i32 frame = 0; frame < frameCount; ++frame )
+			{
+				for ( i32 ox = 0; ox < outFrameW; ++ox )
+				{
+					i32 x0 = frame * frameW + ox * scale;
+					i32 x1 = min_value( x0 + scale, ( frame + 1 ) * frameW );
+
+					u32 colour[ 3 ] = {};
+					u32 weighted[ 3 ] = {};
+					u32 alpha = 0;
+					u32 count = (u32)( ( x1 - x0 ) * ( y1 - y0 ) );
+
+					for ( i32 y = y0; y < y1; ++y )
 					{
-						// first collision is overwritten if their was a global one
-						if ( !manualCol && app->generateCollisionData.enable && collisionCount == 1 )
-						{
-							manualCol = true;
-							collisionCount -= 1;
-						}
-						if ( collisionCount >= MAX_SPRITE_COLLIDERS )
-						{
-							std::println( stderr, "Too many sprite colliders: {} (max is {})", collisionCount, MAX_SPRITE_COLLIDERS );
-							collisionCount = MAX_SPRITE_COLLIDERS - 1;
-							app->problems += 1;
-						}
-						GenCollisionData *colData = &genColData[ collisionCount++ ];
-						colData->enable = true;
-						datafile >> datafileField;
-						if ( datafileField == "RECT" )
-						{
-							datafile >> datafileField;
-							if ( datafileField == "A" ) // Auto
-							{
-								colData->type = GEN_COLLISION_DATA_TYPE_RECT_AUTO;
-							}
-							else if ( datafileField == "F" ) // Full
-							{
-								colData->type = GEN_COLLISION_DATA_TYPE_RECT_FULL;
-							}
-							else if ( datafileField == "M" ) // Manual
-							{
-								colData->type = GEN_COLLISION_DATA_TYPE_RECT_MANUAL;
-								datafile >> colData->area.x;
-								datafile >> colData->area.y;
-								datafile >> colData->area.z;
-								datafile >> colData->area.w;
-							}
-							else
-							{
-								if ( app->verbose )
-									std::println( stderr, "Unknown data file field COL RECT: {}", datafileField );
-								app->problems += 1;
-							}
-						}
-						else if ( datafileField == "CIRCLE" )
+						const u8 *px = &image->img[ ( (u64)y * image->width + x0 ) * 4 ];
+
+						for ( i32 x = x0; x < x1; ++x, px += 4 )
 						{
-							datafile >> datafileField;
-							if ( datafileField == "A" ) // Auto
-							{
-								colData->type = GEN_COLLISION_DATA_TYPE_CIRCLE_AUTO;
-							}
-							else if ( datafileField == "AE" ) // Auto-Emcompass
-							{
-								colData->type = GEN_COLLISION_DATA_TYPE_CIRCLE_AUTO_ENCOMPASS;
-							}
-							else if ( datafileField == "M" ) // Manual
-							{
-								colData->type = GEN_COLLISION_DATA_TYPE_CIRCLE_MANUAL;
-								datafile >> colData->position.x;
-								datafile >> colData->position.y;
-								datafile >> colData->radius;
-							}
-							else
+							for ( i32 c = 0; c < 3; ++c )
 							{
-								if ( app->verbose )
-									std::println( stderr, "Unknown data file field COL CIRCLE: {}", datafileField );
-								app->problems += 1;
+								colour[ c ] += px[ c ];
+								weighted[ c ] += px[ c ] * px[ 3 ];
 							}
+							alpha += px[ 3 ];
 						}
-						else
-						{
-							if ( app->verbose )
-								std::println( stderr, "Unknown data file field for COL: {}", datafileField );
-							app->problems += 1;
-						}
-					}
-					else
-					{
-						if ( app->verbose )
-							std::println( stderr, "Unknown data file field: {}", datafileField );
-						app->problems += 1;
 					}
+
+					u8 *dst = &out[ ( (u64)oy * outW + frame * outFrameW + ox ) * 4 ];
+
+					for ( i32 c = 0; c < 3; ++c )
+						dst[ c ] = (u8)( alpha > 0 ? ( weighted[ c ] + alpha / 2 ) / alpha : ( colour[ c ] + count / 2 ) / count );
+					dst[ 3 ] = (u8)( ( alpha + count / 2 ) / count );
 				}
 			}
+		}
 
-			datafile.close();
+		image->img = out;
+	}
 
-			fileData->map[ filename ] = fileData->group.diffuse.size();
+	image->width = outW;
+	image->height = outH;
+	image->channels = 4;
+	image->imgSize = outW * outH * 4;
+	image->alpha.known = false;
+}
 
-			fileData->rects.emplace_back();
-			stbrp_rect *rect = &fileData->rects.back();
+enum ROTATE_POLICY
+{
+	ROTATE_POLICY_NONE,
+	ROTATE_POLICY_TO_FIT,
+	ROTATE_POLICY_PORTRAIT,
+	ROTATE_POLICY_LANDSCAPE,
+	ROTATE_POLICY_COUNT
+};
 
-			fileData->group.diffuse.emplace_back();
-			image = &fileData->group.diffuse.back();
-			image->filename = filename;
-			image->img = stbi_load( filepath.c_str(), &image->width, &image->height, &image->channels, 4 );
-			image->imgSize = image->width * image->height * image->channels;
+static bool rotate_policy_wants( ROTATE_POLICY policy, i32 w, i32 h, Data *data )
+{
+	switch ( policy )
+	{
+	case ROTATE_POLICY_NONE:       return false;
+	case ROTATE_POLICY_TO_FIT:     return ( w > data->textureWidth || h > data->textureHeight ) && h <= data->textureWidth && w <= data->textureHeight;
+	case ROTATE_POLICY_PORTRAIT:   return w > h && h <= data->textureWidth && w <= data->textureHeight;
+	case ROTATE_POLICY_LANDSCAPE:  return h > w && h <= data->textureWidth && w <= data->textureHeight;
+	default:                       return false;
+	}
+}
 
-			fileData->texpackSprite.emplace_back();
-			TexpackSpriteNamed *spr = &fileData->texpackSprite.back();
+// stb_rect_pack walks the whole skyline for every rect, which is quadratic for icon groups
+// of tens of thousands of sprites, so from this many rects the shelf packer is used instead.
+constexpr u32 SHELF_PACK_MIN_RECTS = 4096;
 
-			if ( frameCount <= 0 )
-				frameCount = 1;
+struct PackShelf
+{
+	i32 y;
+	i32 height;
+	i32 used;
+};
 
-			if ( originX == INT32_MAX )
-				originX = ( image->width / frameCount ) / 2;
+// Rects are bucketed by height ( tallest first, widest first within a bucket ) and each goes on the
+// open shelf with the least width left that still fits it. The open shelves are kept in a multimap
+// by width left, so finding one is a log n lookup instead of a scan. Sorted by height, every open
+// shelf is at least as tall as the rect being placed.
+static bool shelf_pack( stbrp_rect *rects, u32 count, i32 width, i32 height )
+{
+	i32 maxHeight = 0;
+	for ( u32 i = 0; i < count; ++i )
+		maxHeight = max_value( maxHeight, rects[ i ].h );
 
-			if ( originY == INT32_MAX )
-				originY = image->height / 2;
+	if ( maxHeight > height )
+		return false;
 
-			spr->sprite.frameCount = frameCount;
-			spr->sprite.origin = { originX + padding, originY + padding };
-			spr->sprite.nineslice = nineslice;
-			spr->sprite.colliderCount = (u8)collisionCount;
+	std::vector<u32> bucketStart( maxHeight + 2, 0 );
+	for ( u32 i = 0; i < count; ++i )
+		bucketStart[ maxHeight - rects[ i ].h + 1 ] += 1;
+	for ( i32 b = 1; b < maxHeight + 2; ++b )
+		bucketStart[ b ] += bucketStart[ b - 1 ];
 
-			imgWidth = image->width;
-			imgHeight = image->height;
+	std::vector<u32> order( count );
+	for ( u32 i = 0; i < count; ++i )
+		order[ bucketStart[ maxHeight - rects[ i ].h ]++ ] = i;
 
-			image->margin = margin;
-			image->padding = padding;
-			image->width += margin * 2 + padding * 2 * frameCount;
-			image->height += ( margin + padding ) * 2;
-			image->frameW = imgWidth / spr->sprite.frameCount;
-			image->frameH = imgHeight;
-			image->colliderCount = collisionCount;
+	// bucketStart[ b ] is now the end of bucket b
+	for ( i32 b = 0, begin = 0; b <= maxHeight; begin = bucketStart[ b++ ] )
+	{
+		std::stable_sort( order.begin() + begin, order.begin() + bucketStart[ b ], [ rects ]( u32 l, u32 r ) { return rects[ l ].w > rects[ r ].w; } );
+	}
 
-			rect->w = image->width;
-			rect->h = image->height;
+	std::vector<PackShelf> shelves;
+	std::multimap<i32, u32> open;
+	i32 top = 0;
+	bool packedAll = true;
 
-			// Collision
-			for ( u32 colIdx = 0; colIdx < collisionCount; ++colIdx )
-			{
-				GenCollisionData *colData = &genColData[ colIdx ];
+	for ( u32 idx : order )
+	{
+		stbrp_rect &rect = rects[ idx ];
 
-				if ( colData->enable )
-				{
-					switch ( colData->type )
-					{
-					case GEN_COLLISION_DATA_TYPE_RECT_AUTO:
-						colData->area = image_rect_area( image, spr, imgWidth, data );
-						break;
+		if ( rect.w == 0 || rect.h == 0 )
+		{
+			rect.x = 0;
+			rect.y = 0;
+			rect.was_packed = 1;
+			continue;
+		}
+
+		u32 shelf;
+
+		if ( auto iter = open.lower_bound( rect.w ); iter != open.end() )
+		{
+			shelf = iter->second;
+			open.erase( iter );
+		}
+		else if ( rect.w <= width && top + rect.h <= height )
+		{
+			shelf = (u32)shelves.size();
+			shelves.push_back( { top, rect.h, 0 } );
+			top += rect.h;
+		}
+		else
+		{
+			rect.x = STBRP__MAXVAL;
+			rect.y = STBRP__MAXVAL;
+			rect.was_packed = 0;
+			packedAll = false;
+			continue;
+		}
+
+		PackShelf &packShelf = shelves[ shelf ];
+		rect.x = packShelf.used;
+		rect.y = packShelf.y;
+		rect.was_packed = 1;
+		packShelf.used += rect.w;
+
+		if ( packShelf.used < width )
+			open.emplace( width - packShelf.used, shelf );
+	}
+
+	return packedAll;
+}
+
+// Lays the rects out left to right and top to bottom in rect order, in cells the size of the largest rect.
+// Equal rects leave no space between them, O( n ) with no search at all.
+static bool grid_pack( stbrp_rect *rects, u32 count, i32 width, i32 height )
+{
+	i32 cellW = 1;
+	i32 cellH = 1;
+
+	for ( u32 i = 0; i < count; ++i )
+	{
+		cellW = max_value( cellW, rects[ i ].w );
+		cellH = max_value( cellH, rects[ i ].h );
+	}
+
+	i32 columns = width / cellW;
+	u64 cells = (u64)columns * ( height / cellH );
+
+	// the rects past the last cell are left over, so a plan can still tell what overflows
+	for ( u32 i = 0; i < count; ++i )
+	{
+		if ( i < cells )
+		{
+			rects[ i ].x = (i32)( i % columns ) * cellW;
+			rects[ i ].y = (i32)( i / columns ) * cellH;
+			rects[ i ].was_packed = 1;
+		}
+		else
+		{
+			rects[ i ].x = STBRP__MAXVAL;
+			rects[ i ].y = STBRP__MAXVAL;
+			rects[ i ].was_packed = 0;
+		}
+	}
+
+	return count <= cells;
+}
+
+static bool rects_uniform( const std::pmr::vector<stbrp_rect> &rects )
+{
+	return std::all_of( rects.begin(), rects.end(), [ &rects ]( const stbrp_rect &rect ) { return rect.w == rects[ 0 ].w && rect.h == rects[ 0 ].h; } );
+}
+
+static bool pack_attempt( stbrp_rect *rects, u32 count, i32 width, i32 height )
+{
+	if ( count >= SHELF_PACK_MIN_RECTS )
+		return shelf_pack( rects, count, width, height );
+
+	stbrp_context context;
+	std::vector<stbrp_node> nodes( width );
+	stbrp_init_target( &context, width, height, nodes.data(), (i32)nodes.size() );
+	return stbrp_pack_rects( &context, rects, (i32)count ) != 0;
+}
+
+// Packs the rects, when rotation is allowed each policy is tried and the one
+// that packs everything with the lowest used height wins (upright on ties).
+// The policies are independent packs of their own copy of the rects, so they run in parallel.
+static bool pack_rects( App *app, Data *data, std::pmr::vector<stbrp_rect> &rects, std::vector<u8> &rotated )
+{
+	rotated.assign( rects.size(), false );
+
+	// equal rects ( a tile set ) need no search, a grid that does not fit falls back to the packers unless forced
+	if ( data->grid || ( rects.size() > 1 && rects_uniform( rects ) ) )
+	{
+		if ( grid_pack( rects.data(), (u32)rects.size(), data->textureWidth, data->textureHeight ) )
+		{
+			if ( app->verbose )
+				std::println( "Packed {} rects as a grid", rects.size() );
+			return true;
+		}
+
+		if ( data->grid )
+			return false;
+	}
+
+	if ( !data->allowRotation )
+		return pack_attempt( rects.data(), (u32)rects.size(), data->textureWidth, data->textureHeight );
+
+	std::vector<stbrp_rect> attempts[ ROTATE_POLICY_COUNT ];
+	i32 usedHeights[ ROTATE_POLICY_COUNT ];
+
+	parallel_for( ROTATE_POLICY_COUNT, [ & ]( u32 policy )
+	{
+		std::vector<stbrp_rect> &attempt = attempts[ policy ];
+		attempt.assign( rects.begin(), rects.end() );
+
+		for ( stbrp_rect &rect : attempt )
+		{
+			if ( rotate_policy_wants( (ROTATE_POLICY)policy, rect.w, rect.h, data ) )
+				std::swap( rect.w, rect.h );
+		}
+
+		usedHeights[ policy ] = INT32_MAX;
+
+		if ( !pack_attempt( attempt.data(), (u32)attempt.size(), data->textureWidth, data->textureHeight ) )
+			return;
+
+		i32 usedHeight = 0;
+		for ( const stbrp_rect &rect : attempt )
+			usedHeight = max_value( usedHeight, rect.y + rect.h );
+
+		usedHeights[ policy ] = usedHeight;
+	} );
+
+	ROTATE_POLICY bestPolicy = ROTATE_POLICY_COUNT;
+	i32 bestHeight = INT32_MAX;
+
+	for ( i32 policy = ROTATE_POLICY_NONE; policy < ROTATE_POLICY_COUNT; ++policy )
+	{
+		if ( usedHeights[ policy ] < bestHeight )
+		{
+			bestHeight = usedHeights[ policy ];
+			bestPolicy = (ROTATE_POLICY)policy;
+		}
+	}
+
+	if ( bestPolicy == ROTATE_POLICY_COUNT )
+		return false;
+
+	if ( app->verbose )
+		std::println( "Packing with rotate policy {} (used height: {})", (i32)bestPolicy, bestHeight );
+
+	for ( u64 i = 0, count = rects.size(); i < count; ++i )
+	{
+		rotated[ i ] = rotate_policy_wants( bestPolicy, rects[ i ].w, rects[ i ].h, data );
+		rects[ i ] = attempts[ bestPolicy ][ i ];
+	}
+
+	return true;
+}
+
+// Packs random rects of 8 to 64 pixels with both packers and prints the time per count,
+// the shelf packer should stay close to linear where stb_rect_pack grows with the skyline.
+static void benchmark_packer()
+{
+	constexpr u32 counts[] = { 1000, 5000, 10000, 50000, 100000, 200000 };
+
+	std::println( "{:>8} {:>8} {:>12} {:>10} {:>12} {:>10}", "rects", "size", "skyline ms", "occupancy", "shelf ms", "occupancy" );
+
+	for ( u32 count : counts )
+	{
+		std::vector<stbrp_rect> rects( count );
+		u32 seed = 12345;
+		u64 area = 0;
+
+		for ( stbrp_rect &rect : rects )
+		{
+			seed = seed * 1664525u + 1013904223u;
+			rect.w = 8 + (i32)( ( seed >> 8 ) % 57 );
+			seed = seed * 1664525u + 1013904223u;
+			rect.h = 8 + (i32)( ( seed >> 8 ) % 57 );
+			area += (u64)rect.w * rect.h;
+		}
+
+		i32 size = ( (i32)sqrt( (f64)area * 1.3 ) + 63 ) & ~63;
+
+		auto run = [ &rects, size, area ]( bool shelf, f64 *ms, f64 *occupancy )
+		{
+			std::vector<stbrp_rect> attempt = rects;
+			auto start = std::chrono::steady_clock::now();
+
+			bool packed;
+			if ( shelf )
+			{
+				packed = shelf_pack( attempt.data(), (u32)attempt.size(), size, size );
+			}
+			else
+			{
+				stbrp_context context;
+				std::vector<stbrp_node> nodes( size );
+				stbrp_init_target( &context, size, size, nodes.data(), (i32)nodes.size() );
+				packed = stbrp_pack_rects( &context, attempt.data(), (i32)attempt.size() ) != 0;
+			}
+
+			*ms = std::chrono::duration<f64, std::milli>( std::chrono::steady_clock::now() - start ).count();
+
+			i32 usedHeight = 0;
+			for ( const stbrp_rect &rect : attempt )
+				usedHeight = max_value( usedHeight, rect.was_packed ? rect.y + rect.h : 0 );
+
+			*occupancy = packed && usedHeight > 0 ? (f64)area / ( (f64)size * usedHeight ) : 0.0;
+		};
+
+		f64 skylineMs = 0.0, skylineOccupancy = 0.0;
+		f64 shelfMs = 0.0, shelfOccupancy = 0.0;
+
+		run( false, &skylineMs, &skylineOccupancy );
+		run( true, &shelfMs, &shelfOccupancy );
+
+		std::println( "{:>8} {:>8} {:>12.1f} {:>10.3f} {:>12.1f} {:>10.3f}", count, size, skylineMs, skylineOccupancy, shelfMs, shelfOccupancy );
+	}
+}
+
+// Packs each opacity class into its own horizontal band, opaque at the top, so the
+// sprites a renderer draws in one pass sit together in the atlas.
+static bool pack_rects_grouped( App *app, Data *data, std::pmr::vector<stbrp_rect> &rects, std::vector<u8> &rotated, const std::vector<u8> &rectOpacity )
+{
+	rotated.assign( rects.size(), false );
+
+	Data band = *data;
+	i32 bandY = 0;
+
+	std::vector<u32> indices;
+	std::pmr::vector<stbrp_rect> bandRects( rects.get_allocator() );
+	std::vector<u8> bandRotated;
+
+	for ( u8 opacity = 0; opacity < OPACITY_COUNT; ++opacity )
+	{
+		indices.clear();
+		bandRects.clear();
+
+		for ( u32 i = 0, count = (u32)rects.size(); i < count; ++i )
+		{
+			if ( rectOpacity[ i ] == opacity )
+			{
+				indices.push_back( i );
+				bandRects.push_back( rects[ i ] );
+			}
+		}
+
+		if ( indices.empty() )
+			continue;
+
+		band.textureHeight = data->textureHeight - bandY;
+
+		if ( band.textureHeight <= 0 || !pack_rects( app, &band, bandRects, bandRotated ) )
+			return false;
+
+		i32 bandHeight = 0;
+
+		for ( u64 i = 0, count = indices.size(); i < count; ++i )
+		{
+			stbrp_rect &rect = rects[ indices[ i ] ];
+			rect = bandRects[ i ];
+			rect.y += bandY;
+			rotated[ indices[ i ] ] = bandRotated[ i ];
+			bandHeight = max_value( bandHeight, bandRects[ i ].y + bandRects[ i ].h );
+		}
+
+		if ( app->verbose )
+			std::println( "Packed opacity class {} into rows {} to {}", opacity, bandY, bandY + bandHeight );
+
+		bandY += bandHeight;
+	}
+
+	return true;
+}
+
+// What the diffuse of a sprite needs of its RGBA pixels. Gray and RGB need it to be opaque,
+// alpha needs every visible pixel to be white so only the alpha is left to store.
+static CHANNEL_USAGE image_channel_usage( const Image *image, i32 frameCount )
+{
+	i32 inputW = image->width - ( image->margin * 2 + image->padding * 2 * frameCount );
+	i32 inputH = image->height - ( image->margin + image->padding ) * 2;
+
+	bool opaque = !image->alpha.known || image->alpha.opaque;
+	bool gray = true;
+	bool white = true;
+
+	for ( u64 i = 0, count = (u64)inputW * inputH; i < count && ( opaque || white ); ++i )
+	{
+		const u8 *px = &image->img[ i * image->channels ];
+		opaque = opaque && px[ 3 ] == 255;
+		gray = gray && px[ 0 ] == px[ 1 ] && px[ 1 ] == px[ 2 ];
+		white = white && ( px[ 3 ] == 0 || ( px[ 0 ] == 255 && px[ 1 ] == 255 && px[ 2 ] == 255 ) );
+	}
+
+	if ( opaque )
+		return gray ? CHANNEL_USAGE_GRAY : CHANNEL_USAGE_RGB;
+
+	return white ? CHANNEL_USAGE_ALPHA : CHANNEL_USAGE_RGBA;
+}
+
+// Moves the sprites that do not need all four channels into an RGB8 and an R8 atlas, both are only
+// added when a sprite goes into them. Sprites with normal or emissive maps stay in the main atlas
+// as the maps share its placements, padded sprites only leave it for R8 alpha where the padding is 0.
+static void route_channels( const Group &group, std::pmr::vector<TexpackSpriteNamed> &sprites, u32 rectCount, std::vector<u8> &rectAtlas, std::vector<OutputAtlas> &atlases )
+{
+	std::vector<u8> usages( sprites.size(), CHANNEL_USAGE_RGBA );
+
+	parallel_for( (u32)sprites.size(), [ & ]( u32 i )
+	{
+		const Image &diffuse = group.diffuse[ i ];
+
+		if ( !diffuse.img || name_index_find( group.normalIndex, diffuse.filename ) != UINT32_MAX || name_index_find( group.emissiveIndex, diffuse.filename ) != UINT32_MAX )
+			return;
+
+		CHANNEL_USAGE usage = image_channel_usage( &diffuse, sprites[ i ].sprite.frameCount );
+
+		if ( diffuse.padding > 0 && usage != CHANNEL_USAGE_ALPHA )
+			usage = CHANNEL_USAGE_RGBA;
+
+		usages[ i ] = usage;
+	} );
+
+	u8 atlasOf[ CHANNEL_USAGE_COUNT ] = {};
+
+	if ( std::find( usages.begin(), usages.end(), CHANNEL_USAGE_RGB ) != usages.end() )
+	{
+		atlases.push_back( { .suffix = "_rgb", .pixelFormat = PIXEL_FORMAT_RGB8, .channels = 3, .width = 0, .height = 0, .pixels = {} } );
+		atlasOf[ CHANNEL_USAGE_RGB ] = (u8)atlases.size();
+	}
+
+	if ( std::find_if( usages.begin(), usages.end(), []( u8 usage ) { return usage == CHANNEL_USAGE_GRAY || usage == CHANNEL_USAGE_ALPHA; } ) != usages.end() )
+	{
+		atlases.push_back( { .suffix = "_r", .pixelFormat = PIXEL_FORMAT_R8, .channels = 1, .width = 0, .height = 0, .pixels = {} } );
+		atlasOf[ CHANNEL_USAGE_GRAY ] = (u8)atlases.size();
+		atlasOf[ CHANNEL_USAGE_ALPHA ] = (u8)atlases.size();
+	}
+
+	rectAtlas.assign( rectCount, 0 );
+
+	for ( u64 i = 0, count = sprites.size(); i < count; ++i )
+	{
+		TexpackSprite &sprite = sprites[ i ].sprite;
+		sprite.channelUsage = usages[ i ];
+		sprite.atlas = atlasOf[ usages[ i ] ];
+
+		u32 spriteRects = sprite.hasFrameUVs ? (u32)sprite.frameCount : 1;
+		for ( u32 r = 0; r < spriteRects; ++r )
+			rectAtlas[ sprites[ i ].firstRect + r ] = sprite.atlas;
+	}
+}
+
+// Packs the rects of each atlas on their own into the full texture size, the routed atlases
+// are then cut down to the rows they use ( rounded up to whole 4x4 blocks ).
+static bool pack_rects_routed( App *app, Data *data, std::pmr::vector<stbrp_rect> &rects, std::vector<u8> &rotated, const std::vector<u8> &rectOpacity, const std::vector<u8> &rectAtlas, std::vector<OutputAtlas> &atlases )
+{
+	rotated.assign( rects.size(), false );
+
+	std::vector<u32> indices;
+	std::pmr::vector<stbrp_rect> atlasRects( rects.get_allocator() );
+	std::vector<u8> atlasRotated;
+	std::vector<u8> atlasOpacity;
+
+	for ( u32 atlas = 0; atlas <= atlases.size(); ++atlas )
+	{
+		indices.clear();
+		atlasRects.clear();
+		atlasOpacity.clear();
+
+		for ( u32 i = 0, count = (u32)rects.size(); i < count; ++i )
+		{
+			if ( rectAtlas[ i ] == atlas )
+			{
+				indices.push_back( i );
+				atlasRects.push_back( rects[ i ] );
+
+				if ( !rectOpacity.empty() )
+					atlasOpacity.push_back( rectOpacity[ i ] );
+			}
+		}
+
+		bool packed = rectOpacity.empty()
+			? pack_rects( app, data, atlasRects, atlasRotated )
+			: pack_rects_grouped( app, data, atlasRects, atlasRotated, atlasOpacity );
+
+		if ( !packed )
+			return false;
+
+		i32 usedHeight = 0;
+
+		for ( u64 i = 0, count = indices.size(); i < count; ++i )
+		{
+			rects[ indices[ i ] ] = atlasRects[ i ];
+			rotated[ indices[ i ] ] = atlasRotated[ i ];
+			usedHeight = max_value( usedHeight, atlasRects[ i ].y + atlasRects[ i ].h );
+		}
+
+		if ( atlas == 0 )
+			continue;
+
+		OutputAtlas &output = atlases[ atlas - 1 ];
+		output.width = data->textureWidth;
+		output.height = min_value( max_value( ( usedHeight + 3 ) & ~3, 4 ), data->textureHeight );
+
+		if ( app->verbose )
+			std::println( "Routed {} rects into the {} atlas ({}x{})", indices.size(), output.suffix, output.width, output.height );
+	}
+
+	return true;
+}
+
+// Fills in the grid when every rect k sits upright in cell k of a row major grid as wide as the texture,
+// with cells the size of the largest rect and every sprite at the same margin in its cell.
+static bool layout_grid( const std::pmr::vector<stbrp_rect> &rects, const std::vector<u8> &rotated, const std::pmr::vector<Image> &images, Data *data, TexpackGrid *grid )
+{
+	if ( rects.empty() )
+		return false;
+
+	i32 cellW = 1;
+	i32 cellH = 1;
+
+	for ( const stbrp_rect &rect : rects )
+	{
+		cellW = max_value( cellW, rect.w );
+		cellH = max_value( cellH, rect.h );
+	}
+
+	i32 columns = data->textureWidth / cellW;
+
+	for ( u32 i = 0, count = (u32)rects.size(); i < count; ++i )
+	{
+		if ( rotated[ i ] || rects[ i ].x != (i32)( i % columns ) * cellW || rects[ i ].y != (i32)( i / columns ) * cellH )
+			return false;
+	}
+
+	i32 margin = images[ 0 ].margin;
+
+	if ( std::any_of( images.begin(), images.end(), [ margin ]( const Image &image ) { return image.margin != margin; } ) )
+		return false;
+
+	*grid = { { cellW, cellH }, { margin, margin }, (u32)columns, (u32)rects.size() };
+	return true;
+}
+
+// Where a sprite was placed by the previous run, read back from its .dat.
+struct PreviousSprite
+{
+	TexpackSprite sprite;
+	std::vector<TexpackFrame> frames;
+};
+
+// Reads the placements of one layer of a .dat ( or of the .dat inside a bundle ) written by this
+// version for a texture of the current size. Anything else gives an empty layout and a full pack.
+static bool read_previous_layout( const std::string &filename, u16 layer, Data *data, std::unordered_map<std::string, PreviousSprite> &layout )
+{
+	std::ifstream file( filename, std::ios::binary );
+	if ( !file.good() )
+		return false;
+
+	std::string bytes( ( std::istreambuf_iterator<char>( file ) ), std::istreambuf_iterator<char>() );
+	std::string_view view = bytes;
+
+	// a bundle has the .dat after the pixels
+	u64 datOffset = 0;
+	u64 datSize = view.size();
+
+	u32 magicNumber = 0;
+	if ( view.size() >= sizeof( magicNumber ) )
+		memcpy( &magicNumber, view.data(), sizeof( magicNumber ) );
+
+	if ( magicNumber == 'CxeT' && view.size() >= sizeof( TexpackContainerHeader ) )
+	{
+		TexpackContainerHeader container;
+		memcpy( &container, view.data(), sizeof( container ) );
+		datOffset = container.datOffset;
+		datSize = container.datSize;
+	}
+	else if ( magicNumber == 'VxeT' && view.size() >= sizeof( TexpackTileHeader ) )
+	{
+		TexpackTileHeader tilePack;
+		memcpy( &tilePack, view.data(), sizeof( tilePack ) );
+		datOffset = tilePack.datOffset;
+		datSize = tilePack.datSize;
+	}
+
+	if ( datSize == 0 || datOffset > view.size() || datSize > view.size() - datOffset )
+		return false;
+
+	view = view.substr( datOffset, datSize );
+
+	u64 cursor = 0;
+
+	auto read = [ &view, &cursor ]( void *dst, u64 size )
+	{
+		if ( size > view.size() - cursor )
+			return false;
+		memcpy( dst, view.data() + cursor, size );
+		cursor += size;
+		return true;
+	};
+
+	auto skip = [ &view, &cursor ]( u64 size )
+	{
+		if ( size > view.size() - cursor )
+			return false;
+		cursor += size;
+		return true;
+	};
+
+	auto read_name = [ &view, &cursor ]( std::string &name )
+	{
+		u64 end = view.find( '\0', cursor );
+		if ( end == std::string_view::npos )
+			return false;
+		name.assign( view.substr( cursor, end - cursor ) );
+		cursor = end + 1;
+		return true;
+	};
+
+	TexpackHeader header;
+	TexpackTexture texture;
+	std::string name;
+
+	if ( !read( &header, sizeof( header ) ) || header.magicNumber != 'PxeT' || header.majorVersion != VERSION_MAJOR || header.minorVersion != VERSION_MINOR )
+		return false;
+
+	if ( !read_name( name ) || !read( &texture, sizeof( texture ) ) )
+		return false;
+
+	if ( texture.size.x != data->textureWidth || texture.size.y != data->textureHeight )
+		return false;
+
+	// routed sprites were placed in atlases of their own
+	if ( texture.atlasCount != 1 )
+		return false;
+
+	if ( texture.hasGrid && !skip( sizeof( TexpackGrid ) ) )
+		return false;
+
+	for ( u32 i = 0; i < texture.numSprites; ++i )
+	{
+		PreviousSprite previous;
+
+		if ( !read_name( name ) || !read( &previous.sprite, sizeof( TexpackSprite ) ) )
+			return false;
+
+		i32 frameCount = previous.sprite.frameCount;
+
+		if ( frameCount <= 0 )
+			return false;
+
+		if ( previous.sprite.hasFrameUVs )
+		{
+			previous.frames.resize( frameCount );
+			if ( !read( previous.frames.data(), frameCount * sizeof( TexpackFrame ) ) )
+				return false;
+		}
+
+		if ( frameCount > 1 && !skip( frameCount ) )
+			return false;
+
+		if ( !skip( (u64)previous.sprite.tileCount * sizeof( u32 ) ) )
+			return false;
+
+		for ( u8 colIdx = 0; colIdx < previous.sprite.colliderCount; ++colIdx )
+		{
+			u8 colliderType;
+			if ( !read( &colliderType, sizeof( colliderType ) ) )
+				return false;
+
+			bool valid;
+			switch ( colliderType )
+			{
+			case COLLIDER_TYPE_RECT:
+				valid = skip( sizeof( ivec4 ) );
+				break;
+
+			case COLLIDER_TYPE_CIRCLE:
+				valid = skip( sizeof( ivec2 ) + sizeof( i32 ) );
+				break;
+
+			case COLLIDER_TYPE_MASK:
+				{
+					ivec2 maskSize;
+					valid = read( &maskSize, sizeof( maskSize ) ) && maskSize.x >= 0 && maskSize.y >= 0
+						&& skip( (u64)( ( maskSize.x + 63 ) / 64 ) * maskSize.y * frameCount * sizeof( u64 ) );
+				}
+				break;
+
+			default:
+				valid = false;
+				break;
+			}
+
+			if ( !valid )
+				return false;
+		}
+
+		u64 vertexCount = previous.sprite.meshVertexCount;
+		if ( !skip( vertexCount * sizeof( vec2 ) + ( vertexCount > 2 ? ( vertexCount - 2 ) * 3 * sizeof( u16 ) : 0 ) ) )
+			return false;
+
+		if ( previous.sprite.layer == layer )
+			layout[ name ] = std::move( previous );
+	}
+
+	return cursor == view.size();
+}
+
+// A maximal empty rectangle of the atlas, the free space is kept as a list of them that may overlap.
+struct PackFreeRect
+{
+	i32 x;
+	i32 y;
+	i32 w;
+	i32 h;
+};
+
+static bool free_rect_contains( const PackFreeRect &outer, i32 x, i32 y, i32 w, i32 h )
+{
+	return x >= outer.x && y >= outer.y && x + w <= outer.x + outer.w && y + h <= outer.y + outer.h;
+}
+
+// Takes the placed rect out of the free space. Every free rect it overlaps is replaced by the parts
+// left on each side of it, then the new parts that fit inside another free rect are dropped.
+static void free_rects_place( std::vector<PackFreeRect> &freeRects, i32 x, i32 y, i32 w, i32 h )
+{
+	std::vector<PackFreeRect> added;
+
+	for ( u64 i = 0; i < freeRects.size(); )
+	{
+		PackFreeRect f = freeRects[ i ];
+
+		if ( x >= f.x + f.w || x + w <= f.x || y >= f.y + f.h || y + h <= f.y )
+		{
+			++i;
+			continue;
+		}
+
+		if ( x > f.x )
+			added.push_back( { f.x, f.y, x - f.x, f.h } );
+		if ( x + w < f.x + f.w )
+			added.push_back( { x + w, f.y, f.x + f.w - x - w, f.h } );
+		if ( y > f.y )
+			added.push_back( { f.x, f.y, f.w, y - f.y } );
+		if ( y + h < f.y + f.h )
+			added.push_back( { f.x, y + h, f.w, f.y + f.h - y - h } );
+
+		freeRects[ i ] = freeRects.back();
+		freeRects.pop_back();
+	}
+
+	// the untouched free rects are maximal already, only the new parts can be redundant
+	u64 untouched = freeRects.size();
+
+	for ( u64 a = 0; a < added.size(); ++a )
+	{
+		const PackFreeRect &r = added[ a ];
+		bool redundant = false;
+
+		for ( u64 i = 0; i < untouched && !redundant; ++i )
+			redundant = free_rect_contains( freeRects[ i ], r.x, r.y, r.w, r.h );
+
+		// of two equal parts the first one is kept
+		for ( u64 b = 0; b < added.size() && !redundant; ++b )
+		{
+			if ( b != a && free_rect_contains( added[ b ], r.x, r.y, r.w, r.h ) )
+				redundant = b < a || !free_rect_contains( r, added[ b ].x, added[ b ].y, added[ b ].w, added[ b ].h );
+		}
+
+		if ( !redundant )
+			freeRects.push_back( r );
+	}
+}
+
+// Puts every rect whose sprite kept its name, frame count and size back where the previous layout had it,
+// so those sprites are patched in place and keep their uvs. The rects of new and resized sprites, and any
+// that no longer fit where they were ( a changed margin ), are placed into the space left over.
+// Returns false when one of them does not fit.
+static bool stable_pack( Data *data, const std::unordered_map<std::string, PreviousSprite> &layout, const std::pmr::vector<TexpackSpriteNamed> &sprites,
+	const std::pmr::vector<Image> &diffuse, std::pmr::vector<stbrp_rect> &rects, std::vector<u8> &rotated, u32 *keptCount )
+{
+	f32 tw = (f32)data->textureWidth;
+	f32 th = (f32)data->textureHeight;
+
+	std::vector<PackFreeRect> freeRects = { { 0, 0, data->textureWidth, data->textureHeight } };
+	std::vector<u32> moved;
+
+	rotated.assign( rects.size(), false );
+	*keptCount = 0;
+
+	for ( u64 i = 0, count = sprites.size(); i < count; ++i )
+	{
+		const TexpackSpriteNamed &spr = sprites[ i ];
+		const Image &image = diffuse[ i ];
+		u32 rectCount = spr.sprite.hasFrameUVs ? (u32)spr.sprite.frameCount : 1;
+
+		auto found = layout.find( spr.name );
+		const PreviousSprite *previous = found != layout.end() ? &found->second : nullptr;
+
+		bool sameSize = previous
+			&& previous->sprite.frameCount == spr.sprite.frameCount
+			&& previous->sprite.hasFrameUVs == spr.sprite.hasFrameUVs
+			&& previous->sprite.size.x == image.frameW + image.padding * 2
+			&& previous->sprite.size.y == image.frameH + image.padding * 2;
+
+		for ( u32 r = 0; r < rectCount; ++r )
+		{
+			u32 rectIdx = spr.firstRect + r;
+			stbrp_rect &rect = rects[ rectIdx ];
+
+			if ( sameSize )
+			{
+				const vec4 &uvs = spr.sprite.hasFrameUVs ? previous->frames[ r ].uvs : previous->sprite.uvs;
+				bool isRotated = spr.sprite.hasFrameUVs ? previous->frames[ r ].isRotated : previous->sprite.isRotated;
+
+				// the uvs start inside the margin
+				i32 x = (i32)lroundf( uvs.x * tw ) - image.margin;
+				i32 y = (i32)lroundf( uvs.y * th ) - image.margin;
+				i32 w = isRotated ? rect.h : rect.w;
+				i32 h = isRotated ? rect.w : rect.h;
+
+				if ( ( !isRotated || data->allowRotation ) && std::any_of( freeRects.begin(), freeRects.end(), [ & ]( const PackFreeRect &f ) { return free_rect_contains( f, x, y, w, h ); } ) )
+				{
+					free_rects_place( freeRects, x, y, w, h );
+
+					rect.x = x;
+					rect.y = y;
+					rect.w = w;
+					rect.h = h;
+					rect.was_packed = 1;
+					rotated[ rectIdx ] = isRotated;
+					*keptCount += 1;
+					continue;
+				}
+			}
+
+			moved.push_back( rectIdx );
+		}
+	}
+
+	// biggest first, they have the fewest places to go
+	std::stable_sort( moved.begin(), moved.end(), [ &rects ]( u32 l, u32 r )
+	{
+		return max_value( rects[ l ].w, rects[ l ].h ) > max_value( rects[ r ].w, rects[ r ].h );
+	} );
+
+	bool packed = true;
+
+	for ( u32 rectIdx : moved )
+	{
+		stbrp_rect &rect = rects[ rectIdx ];
+
+		// lowest bottom edge then leftmost, upright on ties, so holes are filled before the atlas grows
+		const PackFreeRect *best = nullptr;
+		bool bestRotated = false;
+		i32 bestBottom = INT32_MAX;
+		i32 bestX = INT32_MAX;
+
+		for ( const PackFreeRect &f : freeRects )
+		{
+			for ( bool isRotated : { false, true } )
+			{
+				if ( isRotated && ( !data->allowRotation || rect.w == rect.h ) )
+					continue;
+
+				i32 w = isRotated ? rect.h : rect.w;
+				i32 h = isRotated ? rect.w : rect.h;
+
+				if ( w > f.w || h > f.h )
+					continue;
+
+				if ( f.y + h < bestBottom || ( f.y + h == bestBottom && f.x < bestX ) )
+				{
+					best = &f;
+					bestRotated = isRotated;
+					bestBottom = f.y + h;
+					bestX = f.x;
+				}
+			}
+		}
+
+		if ( !best )
+		{
+			rect.was_packed = 0;
+			packed = false;
+			continue;
+		}
+
+		if ( bestRotated )
+			std::swap( rect.w, rect.h );
+
+		rect.x = best->x;
+		rect.y = best->y;
+		rect.was_packed = 1;
+		rotated[ rectIdx ] = bestRotated;
+
+		free_rects_place( freeRects, rect.x, rect.y, rect.w, rect.h );
+	}
+
+	return packed;
+}
+
+// Directory iteration order depends on the filesystem, so entries are sorted by their
+// generic utf8 path to give the same sprite order ( and output bytes ) on every machine.
+static std::vector<fs::directory_entry> sorted_entries( const fs::path &path, bool recursive )
+{
+	std::vector<std::pair<std::u8string, fs::directory_entry>> entries;
+
+	if ( recursive )
+	{
+		for ( const fs::directory_entry &entry : fs::recursive_directory_iterator( path ) )
+			entries.emplace_back( entry.path().generic_u8string(), entry );
+	}
+	else
+	{
+		for ( const fs::directory_entry &entry : fs::directory_iterator( path ) )
+			entries.emplace_back( entry.path().generic_u8string(), entry );
+	}
+
+	std::sort( entries.begin(), entries.end(), []( const auto &l, const auto &r ) { return l.first < r.first; } );
+
+	std::vector<fs::directory_entry> sorted;
+	sorted.reserve( entries.size() );
+
+	for ( auto &entry : entries )
+		sorted.push_back( std::move( entry.second ) );
+
+	return sorted;
+}
+
+// qsort replacement for stb_rect_pack. It sorts by size only, so equal sized rects
+// keep their input order here instead of whatever order the platform qsort leaves them in.
+static void stable_qsort( void *base, size_t count, size_t size, int ( *compare )( const void*, const void* ) )
+{
+	if ( count == 0 )
+		return;
+
+	u8 *bytes = (u8*)base;
+
+	std::vector<u32> order( count );
+	for ( u32 i = 0; i < (u32)count; ++i )
+		order[ i ] = i;
+
+	std::stable_sort( order.begin(), order.end(), [ bytes, size, compare ]( u32 l, u32 r )
+	{
+		return compare( bytes + l * size, bytes + r * size ) < 0;
+	} );
+
+	std::vector<u8> sorted( count * size );
+	for ( u64 i = 0; i < count; ++i )
+		memcpy( &sorted[ i * size ], bytes + order[ i ] * size, size );
+
+	memcpy( bytes, sorted.data(), sorted.size() );
+}
+
+// Decoded pixels of every png, keyed by a hash of the file contents so an unchanged file is never inflated again.
+// The entries used in a run are copied to a new file that replaces the old one at the end, dropping the rest.
+struct ImageCache
+{
+	bool enabled;
+	std::string path;
+	std::ifstream previous;
+	std::unordered_map<u64, TexpackCacheEntry> entries;
+	std::ofstream next;
+	std::unordered_map<u64, TexpackCacheEntry> written;
+	std::vector<u8> compressed;
+	u32 hits;
+	u32 misses;
+};
+
+static ImageCache imageCache;
+
+static void image_cache_open( const std::string &path )
+{
+	ImageCache &cache = imageCache;
+
+	cache.path = path;
+	cache.previous.open( path, std::ios::binary );
+
+	TexpackCacheHeader header = {};
+
+	if ( cache.previous.good() && cache.previous.read( (char*)&header, sizeof( header ) )
+		&& header.magicNumber == 'KxeT' && header.majorVersion == VERSION_MAJOR && header.minorVersion == VERSION_MINOR )
+	{
+		std::vector<TexpackCacheEntry> index( header.entryCount );
+
+		cache.previous.seekg( header.indexOffset );
+		if ( cache.previous.read( (char*)index.data(), index.size() * sizeof( TexpackCacheEntry ) ) )
+		{
+			for ( const TexpackCacheEntry &entry : index )
+				cache.entries.emplace( (u64)entry.hash, entry );
+		}
+	}
+
+	cache.next.open( path + ".tmp", std::ios::binary );
+
+	if ( !cache.next.good() )
+	{
+		std::println( stderr, "Failed to create image cache: {}.tmp", path );
+		cache.previous.close();
+		cache.entries.clear();
+		return;
+	}
+
+	// the header is written again with the index at the end
+	cache.next.write( (char*)&header, sizeof( header ) );
+	cache.enabled = true;
+}
+
+static bool image_cache_close()
+{
+	ImageCache &cache = imageCache;
+
+	if ( !cache.enabled )
+		return true;
+
+	std::vector<TexpackCacheEntry> index;
+	index.reserve( cache.written.size() );
+
+	for ( const auto &[ hash, entry ] : cache.written )
+		index.push_back( entry );
+
+	// the map order is arbitrary, keep the index in file order
+	std::sort( index.begin(), index.end(), []( const TexpackCacheEntry &l, const TexpackCacheEntry &r ) { return l.offset < r.offset; } );
+
+	TexpackCacheHeader header =
+	{
+		.magicNumber = 'KxeT',
+		.majorVersion = VERSION_MAJOR,
+		.minorVersion = VERSION_MINOR,
+		.revisionVersion = VERSION_REVISION,
+		.reserved = 0,
+		.entryCount = (u32)index.size(),
+		.indexOffset = (u64)cache.next.tellp(),
+	};
+
+	cache.next.write( (char*)index.data(), index.size() * sizeof( TexpackCacheEntry ) );
+	cache.next.seekp( 0 );
+	cache.next.write( (char*)&header, sizeof( header ) );
+
+	bool good = cache.next.good();
+
+	cache.next.close();
+	cache.previous.close();
+	cache.enabled = false;
+
+	std::error_code ec;
+
+	if ( good )
+		fs::rename( cache.path + ".tmp", cache.path, ec );
+
+	if ( !good || ec )
+	{
+		std::println( stderr, "Failed to write image cache: {}", cache.path );
+		return false;
+	}
+
+	std::println( "Image cache: {} hits, {} decoded, {} entries", cache.hits, cache.misses, index.size() );
+	return true;
+}
+
+// Inclusive bounds of the pixels with alpha and whether any alpha is not 255 or is between 0 and 255.
+static void image_alpha_scan( Image *image )
+{
+	ImageAlpha &alpha = image->alpha;
+	alpha = { .known = true, .opaque = true, .translucent = false, .bounds = { image->width, image->height, -1, -1 } };
+
+	for ( i32 y = 0; y < image->height; ++y )
+	{
+		const u8 *row = &image->img[ (u64)y * image->width * 4 ];
+
+		for ( i32 x = 0; x < image->width; ++x )
+		{
+			u8 value = row[ x * 4 + 3 ];
+
+			alpha.opaque = alpha.opaque && value == 255;
+			alpha.translucent = alpha.translucent || ( value != 0 && value != 255 );
+
+			if ( value != 0 )
+			{
+				alpha.bounds.x = min_value( alpha.bounds.x, x );
+				alpha.bounds.y = min_value( alpha.bounds.y, y );
+				alpha.bounds.z = max_value( alpha.bounds.z, x );
+				alpha.bounds.w = max_value( alpha.bounds.w, y );
+			}
+		}
+	}
+}
+
+// Hashes the file bytes, a hit is an lz4 decode of the cached pixels and a miss decodes the png
+// from the bytes and adds it to the cache.
+static bool image_cache_load( Image *image, const std::vector<u8> &file )
+{
+	ImageCache &cache = imageCache;
+
+	u64 fileSize = file.size();
+	u64 hash = hash_bytes( file.data(), fileSize );
+
+	auto found = cache.entries.find( hash );
+
+	if ( found != cache.entries.end() && found->second.fileSize == fileSize )
+	{
+		TexpackCacheEntry entry = found->second;
+		u64 pixelBytes = (u64)entry.width * entry.height * 4;
+
+		cache.compressed.resize( entry.size );
+		cache.previous.seekg( entry.offset );
+
+		u8 *pixels = (u8*)arena_alloc( &groupArena, pixelBytes );
+
+		if ( pixels && cache.previous.read( (char*)cache.compressed.data(), entry.size )
+			&& hash_bytes( cache.compressed.data(), entry.size ) == entry.dataHash && lz_decompress( cache.compressed.data(), entry.size, pixels, (u32)pixelBytes ) )
+		{
+			image->img = pixels;
+			image->width = entry.width;
+			image->height = entry.height;
+			image->channels = entry.channels;
+			image->alpha = { .known = true, .opaque = entry.alphaOpaque, .translucent = entry.alphaTranslucent, .bounds = entry.alphaBounds };
+
+			// the same contents twice in a run are stored once
+			if ( !cache.written.contains( hash ) )
+			{
+				entry.offset = (u64)cache.next.tellp();
+				cache.next.write( (char*)cache.compressed.data(), entry.size );
+				cache.written.emplace( hash, entry );
+			}
+
+			cache.hits += 1;
+			return true;
+		}
+
+		cache.previous.clear();
+	}
+
+	image->img = stbi_load_from_memory( file.data(), (i32)fileSize, &image->width, &image->height, &image->channels, 4 );
+	if ( !image->img )
+		return false;
+
+	image_alpha_scan( image );
+	cache.misses += 1;
+
+	if ( cache.written.contains( hash ) )
+		return true;
+
+	u32 pixelBytes = (u32)( (u64)image->width * image->height * 4 );
+	cache.compressed.resize( lz_compress_bound( pixelBytes ) );
+	u32 size = lz_compress( image->img, pixelBytes, cache.compressed.data() );
+
+	TexpackCacheEntry entry =
+	{
+		.hash = hash,
+		.fileSize = fileSize,
+		.offset = (u64)cache.next.tellp(),
+		.dataHash = hash_bytes( cache.compressed.data(), size ),
+		.size = size,
+		.width = image->width,
+		.height = image->height,
+		.channels = image->channels,
+		.alphaBounds = image->alpha.bounds,
+		.alphaOpaque = image->alpha.opaque,
+		.alphaTranslucent = image->alpha.translucent,
+		.reserved = 0,
+	};
+
+	cache.next.write( (char*)cache.compressed.data(), size );
+	cache.written.emplace( hash, entry );
+
+	return true;
+}
+
+static bool read_file( const std::string &filepath, std::vector<u8> &bytes )
+{
+	std::ifstream input( filepath, std::ios::binary | std::ios::ate );
+	if ( !input.good() )
+		return false;
+
+	bytes.resize( (u64)input.tellg() );
+	input.seekg( 0 );
+
+	return (bool)input.read( (char*)bytes.data(), bytes.size() );
+}
+
+// Reads the files of a group on a few threads ahead of the decoder, so the open and read latency of
+// one file overlaps the decode of the ones before it. At most depth files are read but not yet taken.
+// The reader threads only fill their own buffers, decoding stays on the thread that owns the arena.
+struct FileReadahead
+{
+	struct Slot
+	{
+		std::string path;
+		std::vector<u8> bytes;
+		bool done;
+		bool ok;
+	};
+
+	std::vector<Slot> slots;
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable changed;
+	u32 next;			// next slot a reader claims
+	u32 taken;			// slots the decoder has taken, in order
+	u32 depth;
+	bool stop;
+};
+
+static void readahead_start( FileReadahead *ra, std::vector<std::string> &&paths, u32 depth )
+{
+	ra->slots.resize( paths.size() );
+	for ( u64 i = 0; i < paths.size(); ++i )
+		ra->slots[ i ].path = std::move( paths[ i ] );
+
+	ra->next = 0;
+	ra->taken = 0;
+	ra->depth = depth;
+	ra->stop = false;
+
+	u32 threadCount = min_value( depth, (u32)ra->slots.size() );
+
+	for ( u32 t = 0; t < threadCount; ++t )
+	{
+		ra->threads.emplace_back( [ ra ]()
+		{
+			std::vector<u8> bytes;
+
+			for ( ;; )
+			{
+				u32 index;
+
+				{
+					std::unique_lock lock( ra->mutex );
+					ra->changed.wait( lock, [ ra ]() { return ra->stop || ra->next == ra->slots.size() || ra->next < ra->taken + ra->depth; } );
+
+					if ( ra->stop || ra->next == ra->slots.size() )
+						return;
+
+					index = ra->next++;
+				}
+
+				bool ok = read_file( ra->slots[ index ].path, bytes );
+
+				{
+					std::lock_guard lock( ra->mutex );
+					ra->slots[ index ].bytes.swap( bytes );
+					ra->slots[ index ].done = true;
+					ra->slots[ index ].ok = ok;
+				}
+
+				ra->changed.notify_all();
+			}
+		} );
+	}
+}
+
+// Waits for the next file to be read and swaps its bytes out. False when the readahead is not
+// running, the path is not the next one or it could not be read, the caller reads it itself then.
+static bool readahead_take( FileReadahead *ra, const std::string &path, std::vector<u8> &bytes )
+{
+	if ( ra->threads.empty() || ra->taken == ra->slots.size() || ra->slots[ ra->taken ].path != path )
+		return false;
+
+	FileReadahead::Slot &slot = ra->slots[ ra->taken ];
+	bool ok;
+
+	{
+		std::unique_lock lock( ra->mutex );
+		ra->changed.wait( lock, [ &slot ]() { return slot.done; } );
+
+		bytes.swap( slot.bytes );
+		ok = slot.ok;
+		ra->taken += 1;
+	}
+
+	ra->changed.notify_all();
+	return ok;
+}
+
+static void readahead_stop( FileReadahead *ra )
+{
+	{
+		std::lock_guard lock( ra->mutex );
+		ra->stop = true;
+	}
+
+	ra->changed.notify_all();
+
+	for ( std::thread &thread : ra->threads )
+		thread.join();
+
+	ra->threads.clear();
+	ra->slots.clear();
+}
+
+// Bytes of the png being decoded, kept between files so the buffer is reused.
+static std::vector<u8> fileBytes;
+static FileReadahead readahead;
+
+// With several profiles a group is loaded once per profile. The first load keeps the decoded pixels
+// and alpha here until the next group, the other profiles copy them instead of reading the png again.
+struct DecodedImage
+{
+	std::vector<u8> pixels;
+	i32 width;
+	i32 height;
+	ImageAlpha alpha;
+};
+
+struct DecodeShare
+{
+	bool enabled;
+	std::unordered_map<std::string, DecodedImage> images;
+	u32 hits;
+};
+
+static DecodeShare decodeShare;
+
+// In plan mode only the png header is read for the size and img stays null.
+static bool image_load( Image *image, const std::string &filepath, Data *data )
+{
+	if ( data->plan )
+		return stbi_info( filepath.c_str(), &image->width, &image->height, &image->channels ) != 0;
+
+	if ( auto found = decodeShare.images.find( filepath ); found != decodeShare.images.end() )
+	{
+		const DecodedImage &decoded = found->second;
+
+		image->img = (u8*)arena_alloc( &groupArena, decoded.pixels.size() );
+		if ( !image->img )
+			return false;
+
+		memcpy( image->img, decoded.pixels.data(), decoded.pixels.size() );
+		image->width = decoded.width;
+		image->height = decoded.height;
+		image->channels = 4;
+		image->alpha = decoded.alpha;
+		decodeShare.hits += 1;
+		return true;
+	}
+
+	bool read = readahead_take( &readahead, filepath, fileBytes );
+
+	if ( !read && imageCache.enabled )
+	{
+		if ( !read_file( filepath, fileBytes ) )
+			return false;
+		read = true;
+	}
+
+	if ( imageCache.enabled )
+	{
+		if ( !image_cache_load( image, fileBytes ) )
+			return false;
+	}
+	else
+	{
+		image->img = read
+			? stbi_load_from_memory( fileBytes.data(), (i32)fileBytes.size(), &image->width, &image->height, &image->channels, 4 )
+			: stbi_load( filepath.c_str(), &image->width, &image->height, &image->channels, 4 );
+
+		if ( !image->img )
+			return false;
+	}
+
+	// stb_image reports the channels of the png, the pixels are always expanded to the 4 asked for
+	image->channels = 4;
+
+	if ( decodeShare.enabled )
+	{
+		u64 size = (u64)image->width * image->height * 4;
+		decodeShare.images.emplace( filepath, DecodedImage{ std::vector<u8>( image->img, image->img + size ), image->width, image->height, image->alpha } );
+	}
+
+	return true;
+}
+
+// The sprite a png belongs to, its stem without the _n or _e of a map or the _<frames> of a strip.
+static std::string_view sprite_stem( std::string_view stem )
+{
+	if ( stem.length() > 1 && ( stem.back() == 'n' || stem.back() == 'e' ) && stem[ stem.length() - 2 ] == '_' )
+		return stem.substr( 0, stem.length() - 2 );
+
+	i32 frameCount;
+	size_t found = stem.rfind( '_' );
+
+	if ( found != std::string_view::npos && to_int( std::string( stem.substr( found + 1 ) ), &frameCount ) )
+		return stem.substr( 0, found );
+
+	return stem;
+}
+
+RESULT_CODE image_files( const char *path, App *app, Data *data, ImageFilesData *fileData )
+{
+	RESULT_CODE ret = RESULT_CODE_SUCCESS;
+
+	fs::path entrypath;
+	std::string filepath;
+	std::string filename;
+	std::string datafilename;
+	std::ifstream datafile;
+	std::string datafileField;
+	i32 frameCount;
+	i32 margin;
+	i32 padding;
+	i32 originX;
+	i32 originY;
+	i32 imgWidth;
+	i32 imgHeight;
+	u16 nineslice;
+	i32 meshVertices;
+	i32 sdfSpread;
+	i32 sdfDownscale;
+	bool splitFrames;
+	bool manualCol;
+	u32 collisionCount;
+	GenCollisionData genColData[ MAX_SPRITE_COLLIDERS ];
+	std::vector<vec2> hull;
+
+	filepath.reserve( 1024 );
+	filename.reserve( 1024 );
+	datafilename.reserve( 1024 );
+	datafileField.reserve( 1024 );
+
+	std::vector<fs::directory_entry> entries = sorted_entries( path, true );
+
+	// a page only takes the pngs of its own sprites from the group, the datafiles are kept for the lookup below
+	if ( fileData->page )
+	{
+		std::erase_if( entries, [ fileData ]( const fs::directory_entry &entry )
+		{
+			if ( entry.is_directory() || entry.path().extension() == ".txt" )
+				return false;
+
+			auto stem = entry.path().stem().u8string();
+			std::string_view name = sprite_stem( { reinterpret_cast<const char*>( stem.data() ), stem.size() } );
+			return !fileData->page->sprites.contains( fileData->prefix + std::string( name ) );
+		} );
+	}
+
+	// the listing already says which datafiles exist, so there is no failing open per image
+	std::unordered_set<std::string> datafiles;
+	std::vector<std::string> readPaths;
+
+	for ( const fs::directory_entry &entry : entries )
+	{
+		if ( entry.is_directory() )
+			continue;
+
+		auto fp = entry.path().u8string();
+		std::string entryPath( reinterpret_cast<const char*>( fp.data() ), fp.size() );
+
+		if ( entry.path().extension() == ".txt" )
+			datafiles.insert( std::move( entryPath ) );
+		else
+			readPaths.push_back( std::move( entryPath ) );
+	}
+
+	// a profile after the first copies the pixels the first one decoded and reads nothing
+	if ( data->ioDepth > 0 && !data->plan && decodeShare.images.empty() )
+		readahead_start( &readahead, std::move( readPaths ), data->ioDepth );
+
+	for ( const fs::directory_entry &entry : entries )
+	{
+		if ( entry.is_directory() )
+			continue;
+
+		entrypath = entry.path();
+
+		if ( entrypath.extension() == ".txt" )
+			continue;
+
+		auto fp = entrypath.u8string();
+		auto fn = entrypath.stem().u8string();
+
+		filepath.assign( reinterpret_cast<const char*>( fp.data() ), fp.size() );
+		filename.assign( reinterpret_cast<const char*>( fn.data() ), fn.size() );
+
+		if ( app->verbose )
+			std::println( "Processing file: {}", filepath );
+
+		frameCount = -1;
+		margin = data->margin;
+		padding = data->padding;
+		originX = INT32_MAX;
+		originY = INT32_MAX;
+		nineslice = 0;
+		meshVertices = data->meshVertices;
+		sdfSpread = 0;
+		sdfDownscale = 1;
+		splitFrames = data->splitFrames;
+		collisionCount = app->generateCollisionData.enable ? 1 : 0;
+		genColData[ 0 ] = app->generateCollisionData;
+		manualCol = false;
+
+		Image *image = nullptr;
+		bool loaded = false;
+
+		if ( filename.length() > 1 && filename.back() == 'n' && filename[ filename.length() - 2 ] == '_' )
+		{
+			filename.insert( 0, fileData->prefix );
+			std::string_view name = arena_intern( &groupArena, filename );
+			name_index_set( &fileData->group.normalIndex, name.substr( 0, name.length() - 2 ), (u32)fileData->group.normal.size() );
+			fileData->group.normal.emplace_back();
+			image = &fileData->group.normal.back();
+			image->filename = name;
+			loaded = image_load( image, filepath, data );
+			if ( data->scale > 1 && loaded )
+				image_downscale( image, 1, data->scale );
+			image->imgSize = image->width * image->height * image->channels;
+		}
+		else if ( filename.length() > 1 && filename.back() == 'e' && filename[ filename.length() - 2 ] == '_' )
+		{
+			filename.insert( 0, fileData->prefix );
+			std::string_view name = arena_intern( &groupArena, filename );
+			name_index_set( &fileData->group.emissiveIndex, name.substr( 0, name.length() - 2 ), (u32)fileData->group.emissive.size() );
+			fileData->group.emissive.emplace_back();
+			image = &fileData->group.emissive.back();
+			image->filename = name;
+			loaded = image_load( image, filepath, data );
+			if ( data->scale > 1 && loaded )
+				image_downscale( image, 1, data->scale );
+			image->imgSize = image->width * image->height * image->channels;
+		}
+		else
+		{
+			if ( frameCount == -1 )
+			{
+				frameCount = 1;
+
+				size_t found = filename.rfind( "_" );
+
+				if ( found != std::string::npos )
+				{
+					if ( to_int( &filename[ found + 1 ], &frameCount ) )
+					{
+						filename.erase( found );
+					}
+				}
+			}
+
+			auto df = ( entrypath.parent_path() / filename ).replace_extension( "txt" ).u8string();
+			datafilename.assign( reinterpret_cast<const char*>( df.data() ), df.size() );
+
+			if ( datafiles.contains( datafilename ) )
+				datafile.open( datafilename, std::ios::binary );
+
+			if ( datafile.is_open() )
+			{
+				if ( app->verbose )
+					std::println( "Reading datafile: {}", datafilename );
+
+				while ( !datafile.eof() && datafile.good() )
+				{
+					if ( !( datafile >> datafileField ) )
+						break;
+
+					if ( datafileField == "FC" )
+					{
+						datafile >> frameCount;
+					}
+					else if ( datafileField == "MG" )
+					{
+						datafile >> margin;
+					}
+					else if ( datafileField == "PD" )
+					{
+						datafile >> padding;
+					}
+					else if ( datafileField == "OR" )
+					{
+						datafile >> originX;
+						datafile >> originY;
+					}
+					else if ( datafileField == "NS" )
+					{
+						i32 value;
+						datafile >> value;
+						if ( value < 0 || value > 65535 )
+						{
+							std::println( stderr, "Nineslice value out of bounds: {} (max is 65535)", value );
+							value = 0;
+						}
+						nineslice = (u16)value;
+					}
+					else if ( datafileField == "SF" )
+					{
+						i32 value;
+						datafile >> value;
+						splitFrames = value != 0;
+					}
+					else if ( datafileField == "MS" )
+					{
+						datafile >> meshVertices;
+					}
+					else if ( datafileField == "SDF" )
+					{
+						datafile >> sdfSpread;
+						datafile >> sdfDownscale;
+						if ( sdfSpread < 1 || sdfSpread > 255 || sdfDownscale < 1 || sdfDownscale > 16 )
+						{
+							std::println( stderr, "SDF values out of bounds: {} {} (spread 1 to 255, downscale 1 to 16)", sdfSpread, sdfDownscale );
+							sdfSpread = 0;
+							sdfDownscale = 1;
+							app->problems += 1;
+						}
+					}
+					else if ( datafileField == "COL" )
+					{
+						// first collision is overwritten if their was a global one
+						if ( !manualCol && app->generateCollisionData.enable && collisionCount == 1 )
+						{
+							manualCol = true;
+							collisionCount -= 1;
+						}
+						if ( collisionCount >= MAX_SPRITE_COLLIDERS )
+						{
+							std::println( stderr, "Too many sprite colliders: {} (max is {})", collisionCount, MAX_SPRITE_COLLIDERS );
+							collisionCount = MAX_SPRITE_COLLIDERS - 1;
+							app->problems += 1;
+						}
+						GenCollisionData *colData = &genColData[ collisionCount++ ];
+						colData->enable = true;
+						colData->mask.clear();
+						datafile >> datafileField;
+						if ( datafileField == "RECT" )
+						{
+							datafile >> datafileField;
+							if ( datafileField == "A" ) // Auto
+							{
+								colData->type = GEN_COLLISION_DATA_TYPE_RECT_AUTO;
+							}
+							else if ( datafileField == "F" ) // Full
+							{
+								colData->type = GEN_COLLISION_DATA_TYPE_RECT_FULL;
+							}
+							else if ( datafileField == "M" ) // Manual
+							{
+								colData->type = GEN_COLLISION_DATA_TYPE_RECT_MANUAL;
+								datafile >> colData->area.x;
+								datafile >> colData->area.y;
+								datafile >> colData->area.z;
+								datafile >> colData->area.w;
+							}
+							else
+							{
+								if ( app->verbose )
+									std::println( stderr, "Unknown data file field COL RECT: {}", datafileField );
+								app->problems += 1;
+							}
+						}
+						else if ( datafileField == "CIRCLE" )
+						{
+							datafile >> datafileField;
+							if ( datafileField == "A" ) // Auto
+							{
+								colData->type = GEN_COLLISION_DATA_TYPE_CIRCLE_AUTO;
+							}
+							else if ( datafileField == "AE" ) // Auto-Emcompass
+							{
+								colData->type = GEN_COLLISION_DATA_TYPE_CIRCLE_AUTO_ENCOMPASS;
+							}
+							else if ( datafileField == "M" ) // Manual
+							{
+								colData->type = GEN_COLLISION_DATA_TYPE_CIRCLE_MANUAL;
+								datafile >> colData->position.x;
+								datafile >> colData->position.y;
+								datafile >> colData->radius;
+							}
+							else
+							{
+								if ( app->verbose )
+									std::println( stderr, "Unknown data file field COL CIRCLE: {}", datafileField );
+								app->problems += 1;
+							}
+						}
+						else if ( datafileField == "MASK" )
+						{
+							colData->type = GEN_COLLISION_DATA_TYPE_MASK;
+							datafile >> datafileField;
+							if ( datafileField == "A" ) // Auto (any alpha)
+							{
+								colData->threshold = 1;
+							}
+							else if ( datafileField == "T" ) // Threshold
+							{
+								datafile >> colData->threshold;
+								if ( colData->threshold < 1 || colData->threshold > 255 )
+								{
+									std::println( stderr, "Mask threshold out of bounds: {} (1 to 255)", colData->threshold );
+									colData->threshold = 1;
+									app->problems += 1;
+								}
+							}
+							else
+							{
+								if ( app->verbose )
+									std::println( stderr, "Unknown data file field COL MASK: {}", datafileField );
+								app->problems += 1;
+							}
+						}
+						else
+						{
+							if ( app->verbose )
+								std::println( stderr, "Unknown data file field for COL: {}", datafileField );
+							app->problems += 1;
+						}
+					}
+					else
+					{
+						if ( app->verbose )
+							std::println( stderr, "Unknown data file field: {}", datafileField );
+						app->problems += 1;
+					}
+				}
+			}
+
+			datafile.close();
+
+			filename.insert( 0, fileData->prefix );
+
+			fileData->group.diffuse.emplace_back();
+			image = &fileData->group.diffuse.back();
+			image->filename = arena_intern( &groupArena, filename );
+			loaded = image_load( image, filepath, data );
+			image->imgSize = image->width * image->height * image->channels;
+
+			fileData->texpackSprite.emplace_back();
+			TexpackSpriteNamed *spr = &fileData->texpackSprite.back();
+			spr->name = filename;
+
+			if ( frameCount <= 0 )
+				frameCount = 1;
+
+			// everything after works on the distance field as if it was the image
+			if ( sdfSpread > 0 && loaded )
+			{
+				image_sdf( image, frameCount, sdfSpread, sdfDownscale * data->scale );
+				spr->sprite.sdfSpread = (f32)sdfSpread / ( sdfDownscale * data->scale );
+			}
+			else if ( data->scale > 1 && loaded )
+			{
+				image_downscale( image, frameCount, data->scale );
+			}
+
+			// datafile values are in source pixels, a distance field grew by the spread on every side before it was reduced
+			i32 sourceShift = sdfSpread;
+			i32 sourceReduce = ( sdfSpread > 0 ? sdfDownscale : 1 ) * data->scale;
+
+			if ( originX != INT32_MAX )
+				originX = ( originX + sourceShift ) / sourceReduce;
+
+			if ( originY != INT32_MAX )
+				originY = ( originY + sourceShift ) / sourceReduce;
+
+			if ( originX == INT32_MAX )
+				originX = ( image->width / frameCount ) / 2;
+
+			if ( originY == INT32_MAX )
+				originY = image->height / 2;
+
+			// the nineslice corners are measured from the edge of the sprite, which the spread moved out
+			if ( nineslice > 0 )
+				nineslice = (u16)( ( nineslice + sourceShift ) / sourceReduce );
+
+			for ( u32 colIdx = 0; colIdx < collisionCount; ++colIdx )
+			{
+				GenCollisionData *colData = &genColData[ colIdx ];
+
+				if ( colData->type == GEN_COLLISION_DATA_TYPE_RECT_MANUAL )
+				{
+					colData->area.x = ( colData->area.x + sourceShift ) / sourceReduce;
+					colData->area.y = ( colData->area.y + sourceShift ) / sourceReduce;
+					colData->area.z /= sourceReduce;
+					colData->area.w /= sourceReduce;
+				}
+				else if ( colData->type == GEN_COLLISION_DATA_TYPE_CIRCLE_MANUAL )
+				{
+					colData->position.x = ( colData->position.x + sourceShift ) / sourceReduce;
+					colData->position.y = ( colData->position.y + sourceShift ) / sourceReduce;
+					colData->radius /= sourceReduce;
+				}
+			}
+
+			spr->sprite.frameCount = frameCount;
+			spr->sprite.origin = { originX + padding, originY + padding };
+			spr->sprite.nineslice = nineslice;
+			spr->sprite.colliderCount = (u8)collisionCount;
+
+			imgWidth = image->width;
+			imgHeight = image->height;
+
+			image->margin = margin;
+			image->padding = padding;
+			image->width += margin * 2 + padding * 2 * frameCount;
+			image->height += ( margin + padding ) * 2;
+			image->frameW = imgWidth / spr->sprite.frameCount;
+			image->frameH = imgHeight;
+
+			spr->firstRect = (u32)fileData->rects.size();
+			spr->sprite.hasFrameUVs = splitFrames && frameCount > 1;
+
+			if ( spr->sprite.hasFrameUVs )
+			{
+				for ( i32 frame = 0; frame < frameCount; ++frame )
+				{
+					stbrp_rect *rect = &fileData->rects.emplace_back();
+					rect->w = image->frameW + ( margin + padding ) * 2;
+					rect->h = image->height;
+				}
+			}
+			else
+			{
+				stbrp_rect *rect = &fileData->rects.emplace_back();
+				rect->w = image->width;
+				rect->h = image->height;
+			}
+
+			// Opacity
+			if ( image->img )
+				spr->sprite.opacity = image_opacity( image, imgWidth, frameCount, data->cutoutTolerance, spr->frameOpacity );
+
+			// Collision
+			spr->firstCollider = (u32)fileData->group.colliders.size();
+
+			for ( u32 colIdx = 0; colIdx < collisionCount; ++colIdx )
+			{
+				GenCollisionData *colData = &genColData[ colIdx ];
+				GenCollisionData &collider = fileData->group.colliders.emplace_back();
+
+				if ( colData->enable && image->img )
+				{
+					switch ( colData->type )
+					{
+					case GEN_COLLISION_DATA_TYPE_RECT_AUTO:
+						colData->area = image_rect_area( image, spr, imgWidth, data );
+						break;
+
+					case GEN_COLLISION_DATA_TYPE_RECT_FULL:
+						colData->area = { padding, padding, image->frameW, image->frameH };
+						break;
+
+					case GEN_COLLISION_DATA_TYPE_RECT_MANUAL:
+						break;
+
+					case GEN_COLLISION_DATA_TYPE_CIRCLE_AUTO:
+						colData->area = image_rect_area( image, spr, imgWidth, data );
+						colData->position = { ( image->frameW + padding * 2 ) / 2, ( image->frameH + padding * 2 ) / 2 };
+						colData->radius = max_value( ( colData->area.z - colData->area.x ), ( colData->area.w - colData->area.y ) );
+						break;
+
+					case GEN_COLLISION_DATA_TYPE_CIRCLE_AUTO_ENCOMPASS:
+						{
+							colData->area = image_rect_area( image, spr, imgWidth, data );
+							colData->position = { ( image->frameW + padding * 2 ) / 2, ( image->frameH + padding * 2 ) / 2 };
+							f32 x = (f32)max_value( abs( colData->area.x ), colData->area.z );
+							f32 y = (f32)max_value( abs( colData->area.y ), colData->area.w );
+							colData->radius = (i32)sqrtf( x * x + y * y );
+						}
+						break;
+
+					case GEN_COLLISION_DATA_TYPE_CIRCLE_MANUAL:
+						break;
+
+					case GEN_COLLISION_DATA_TYPE_MASK:
+						image_collision_mask( image, colData, imgWidth, frameCount );
+						break;
+					}
+
+					collider = std::move( *colData );
+				}
+			}
+
+			// Mesh
+			spr->firstMeshVertex = (u32)fileData->group.meshVertices.size();
+
+			if ( meshVertices != 0 && image->img )
+			{
+				if ( meshVertices < MIN_MESH_VERTICES || meshVertices > MAX_MESH_VERTICES )
+				{
+					std::println( stderr, "Mesh vertex count out of bounds: {} ({} to {})", meshVertices, MIN_MESH_VERTICES, MAX_MESH_VERTICES );
+					meshVertices = min_value( max_value( meshVertices, MIN_MESH_VERTICES ), MAX_MESH_VERTICES );
+					app->problems += 1;
+				}
+
+				hull.clear();
+				image_outline_mesh( image, imgWidth, frameCount, meshVertices, hull );
+				fileData->group.meshVertices.insert( fileData->group.meshVertices.end(), hull.begin(), hull.end() );
+				spr->sprite.meshVertexCount = (u8)hull.size();
+			}
+		}
+
+		if ( !loaded )
+		{
+			std::println( stderr, "Failed to open image: {}", filepath );
+			readahead_stop( &readahead );
+			return RESULT_CODE_FAILED_TO_OPEN_IMAGE;
+		}
+	}
+
+	readahead_stop( &readahead );
+
+	return ret;
+}
+
+// sRGB to linear for every 8 bit value and linear back to sRGB at 16 bit precision,
+// the 16 bit side keeps dark premultiplied values from collapsing together.
+struct SrgbTables
+{
+	f32 toLinear[ 256 ];
+	u8 toSrgb[ 65536 ];
+};
+
+static const SrgbTables &srgb_tables()
+{
+	static const SrgbTables *tables = []()
+	{
+		SrgbTables *t = new SrgbTables;
+
+		for ( i32 i = 0; i < 256; ++i )
+		{
+			f32 c = i / 255.0f;
+			t->toLinear[ i ] = c <= 0.04045f ? c / 12.92f : powf( ( c + 0.055f ) / 1.055f, 2.4f );
+		}
+
+		for ( i32 i = 0; i < 65536; ++i )
+		{
+			f32 l = i / 65535.0f;
+			f32 c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf( l, 1.0f / 2.4f ) - 0.055f;
+			t->toSrgb[ i ] = (u8)( c * 255.0f + 0.5f );
+		}
+
+		return t;
+	}();
+
+	return *tables;
+}
+
+// Multiplies the colour by alpha in linear space, so a half transparent edge keeps the
+// brightness it had when blended straight. Rows are split over threads, runs of four fully
+// opaque or fully transparent pixels are handled with SSE2 without touching the tables.
+static void premultiply_alpha( std::vector<u8> &pixels, i32 width, i32 height )
+{
+	const SrgbTables &tables = srgb_tables();
+
+	auto premultiply = [ &tables ]( u8 *px )
+	{
+		f32 alpha = px[ 3 ] * ( 65535.0f / 255.0f );
+		px[ 0 ] = tables.toSrgb[ (u32)( tables.toLinear[ px[ 0 ] ] * alpha + 0.5f ) ];
+		px[ 1 ] = tables.toSrgb[ (u32)( tables.toLinear[ px[ 1 ] ] * alpha + 0.5f ) ];
+		px[ 2 ] = tables.toSrgb[ (u32)( tables.toLinear[ px[ 2 ] ] * alpha + 0.5f ) ];
+	};
+
+	parallel_for( (u32)height, [ & ]( u32 y )
+	{
+		u8 *row = &pixels[ (u64)y * width * 4 ];
+		i32 x = 0;
+
+#ifdef TEXPACK_SSE2
+		const __m128i alphaMask = _mm_set1_epi32( (i32)0xFF000000 );
+
+		for ( ; x + 4 <= width; x += 4 )
+		{
+			__m128i px = _mm_loadu_si128( (const __m128i*)( row + x * 4 ) );
+			__m128i alpha = _mm_and_si128( px, alphaMask );
+
+			if ( _mm_movemask_epi8( _mm_cmpeq_epi32( alpha, alphaMask ) ) == 0xFFFF )
+				continue;
+
+			if ( _mm_movemask_epi8( _mm_cmpeq_epi32( alpha, _mm_setzero_si128() ) ) == 0xFFFF )
+			{
+				_mm_storeu_si128( (__m128i*)( row + x * 4 ), _mm_setzero_si128() );
+				continue;
+			}
+
+			for ( i32 i = 0; i < 4; ++i )
+				premultiply( row + ( x + i ) * 4 );
+		}
+#endif
+
+		for ( ; x < width; ++x )
+		{
+			if ( row[ x * 4 + 3 ] != 255 )
+				premultiply( row + x * 4 );
+		}
+	} );
+}
+
+struct ContainerLayer
+{
+	const u8 *pixels;
+	i32 width;
+	i32 height;
+	i32 channels;
+};
+
+static PIXEL_FORMAT pixel_format( i32 channels )
+{
+	return channels == 1 ? PIXEL_FORMAT_R8 : channels == 3 ? PIXEL_FORMAT_RGB8 : PIXEL_FORMAT_RGBA8;
+}
+
+static u32 pixel_format_size( PIXEL_FORMAT pixelFormat )
+{
+	switch ( pixelFormat )
+	{
+	case PIXEL_FORMAT_RGBA8:	return 4;
+	case PIXEL_FORMAT_RGB8:		return 3;
+	case PIXEL_FORMAT_R8:		return 1;
+	case PIXEL_FORMAT_RGBA4444:	return 2;
+	}
+	return 4;
+}
+
+// Rounds every channel to 4 bits, no dithering so the packed pixels only depend on their own value.
+static void pack_rgba4444( const u8 *pixels, u64 pixelCount, std::vector<u8> &packed )
+{
+	packed.resize( pixelCount * 2 );
+
+	auto to4 = []( u8 value ) { return (u32)( ( value * 15 + 127 ) / 255 ); };
+
+	for ( u64 i = 0; i < pixelCount; ++i )
+	{
+		const u8 *px = &pixels[ i * 4 ];
+		u16 value = (u16)( to4( px[ 0 ] ) << 12 | to4( px[ 1 ] ) << 8 | to4( px[ 2 ] ) << 4 | to4( px[ 3 ] ) );
+		memcpy( &packed[ i * 2 ], &value, sizeof( value ) );
+	}
+}
+
+// Upload ready texture file, see README.md for the layout.
+// Each mip is split into independent chunks so a loader can decompress them in parallel.
+static bool write_texture_container( const std::string &filename, const ContainerLayer *layers, u16 layerCount, const std::string *dat, App *app, Data *data )
+{
+	constexpr u32 chunkSize = 256 * 1024;
+	constexpr u64 dataAlignment = 16;
+
+	u16 mipCount = 1;
+	u32 channels = (u32)layers[ 0 ].channels;
+	PIXEL_FORMAT pixelFormat = pixel_format( channels );
+
+	// everything before works on 8 bit channels, 16 bit pixels are packed here
+	std::vector<std::vector<u8>> packed;
+	std::vector<ContainerLayer> packedLayers;
+
+	if ( data->pixelFormat == PIXEL_FORMAT_RGBA4444 && pixelFormat == PIXEL_FORMAT_RGBA8 )
+	{
+		packed.resize( layerCount );
+		packedLayers.assign( layers, layers + layerCount );
+
+		parallel_for( layerCount, [ & ]( u32 layer )
+		{
+			pack_rgba4444( layers[ layer ].pixels, (u64)layers[ layer ].width * layers[ layer ].height, packed[ layer ] );
+			packedLayers[ layer ].pixels = packed[ layer ].data();
+		} );
+
+		layers = packedLayers.data();
+		pixelFormat = PIXEL_FORMAT_RGBA4444;
+	}
+
+	u32 pixelSize = pixel_format_size( pixelFormat );
+
+	// qoi only encodes 3 or 4 channels of 8 bits, routed single channel atlases and 16 bit pixels fall back to lz4
+	TEXTURE_CODEC codec = data->codec == TEXTURE_CODEC_QOI && ( channels == 1 || pixelFormat == PIXEL_FORMAT_RGBA4444 ) ? TEXTURE_CODEC_LZ4 : data->codec;
+
+	std::vector<TexpackContainerMip> mips( layerCount * mipCount );
+	std::vector<TexpackContainerChunk> chunks;
+	std::vector<std::vector<u8>> chunkData;
+
+	for ( u16 layer = 0; layer < layerCount; ++layer )
+	{
+		TexpackContainerMip *mip = &mips[ layer * mipCount ];
+		mip->size = { layers[ layer ].width, layers[ layer ].height };
+		mip->rawSize = (u64)mip->size.x * mip->size.y * pixelSize;
+		mip->firstChunk = (u32)chunks.size();
+		mip->chunkCount = codec == TEXTURE_CODEC_QOI ? 1 : (u32)( ( mip->rawSize + chunkSize - 1 ) / chunkSize );
+
+		for ( u32 c = 0; c < mip->chunkCount; ++c )
+		{
+			u64 rawOffset = (u64)c * chunkSize;
+			chunks.push_back( { .offset = rawOffset, .size = 0, .rawSize = (u32)min_value( (u64)chunkSize, mip->rawSize - rawOffset ) } );
+		}
+	}
+
+	chunkData.resize( chunks.size() );
+
+	// with a stable layout most of the texture is what the last run wrote, so an lz4 chunk that
+	// decodes to the same bytes is copied from the previous file instead of being compressed again
+	std::string previous;
+	const TexpackContainerChunk *previousChunks = nullptr;
+	std::atomic<u32> reusedChunks = 0;
+
+	if ( data->stable && codec == TEXTURE_CODEC_LZ4 )
+	{
+		std::ifstream previousFile( filename, std::ios::binary );
+		if ( previousFile.good() )
+			previous.assign( std::istreambuf_iterator<char>( previousFile ), std::istreambuf_iterator<char>() );
+
+		TexpackContainerHeader previousHeader;
+		if ( previous.size() >= sizeof( previousHeader ) )
+		{
+			memcpy( &previousHeader, previous.data(), sizeof( previousHeader ) );
+
+			u64 tableOffset = sizeof( TexpackContainerHeader ) + (u64)previousHeader.layerCount * previousHeader.mipCount * sizeof( TexpackContainerMip );
+
+			if ( previousHeader.magicNumber == 'CxeT'
+				&& previousHeader.majorVersion == VERSION_MAJOR && previousHeader.minorVersion == VERSION_MINOR
+				&& previousHeader.codec == codec && previousHeader.chunkSize == chunkSize && previousHeader.pixelFormat == pixelFormat
+				&& previousHeader.size.x == layers[ 0 ].width && previousHeader.size.y == layers[ 0 ].height
+				&& previousHeader.layerCount == layerCount && previousHeader.mipCount == mipCount && previousHeader.chunkCount == chunks.size()
+				&& tableOffset + chunks.size() * sizeof( TexpackContainerChunk ) <= previous.size() )
+			{
+				previousChunks = (const TexpackContainerChunk*)( previous.data() + tableOffset );
+			}
+		}
+	}
+
+	// chunk offsets are relative to their mip until the file is laid out
+	parallel_for( (u32)chunks.size(), [ & ]( u32 c )
+	{
+		u32 layer = 0;
+		while ( c >= mips[ layer * mipCount ].firstChunk + mips[ layer * mipCount ].chunkCount )
+			++layer;
+
+		const TexpackContainerMip *mip = &mips[ layer * mipCount ];
+		const u8 *src = layers[ layer ].pixels + chunks[ c ].offset;
+		std::vector<u8> &out = chunkData[ c ];
+
+		switch ( codec )
+		{
+		case TEXTURE_CODEC_NONE:
+			out.assign( src, src + chunks[ c ].rawSize );
+			break;
+
+		case TEXTURE_CODEC_LZ4:
+			if ( previousChunks )
+			{
+				TexpackContainerChunk old;
+				memcpy( &old, &previousChunks[ c ], sizeof( old ) );
+
+				if ( old.rawSize == chunks[ c ].rawSize && old.offset <= previous.size() && old.size <= previous.size() - old.offset )
+				{
+					const u8 *compressed = (const u8*)previous.data() + old.offset;
+					std::vector<u8> raw( old.rawSize );
+
+					if ( lz_decompress( compressed, old.size, raw.data(), old.rawSize ) && memcmp( raw.data(), src, old.rawSize ) == 0 )
+					{
+						out.assign( compressed, compressed + old.size );
+						reusedChunks += 1;
+						break;
+					}
+				}
+			}
+
+			out.resize( lz_compress_bound( chunks[ c ].rawSize ) );
+			out.resize( lz_compress( src, chunks[ c ].rawSize, out.data() ) );
+			break;
+
+		case TEXTURE_CODEC_QOI:
+			out.resize( qoi_encode_bound( mip->size.x, mip->size.y ) );
+			out.resize( qoi_encode( src, mip->size.x, mip->size.y, channels, out.data() ) );
+			chunks[ c ].rawSize = (u32)mip->rawSize;
+			break;
+		}
+
+		chunks[ c ].size = (u32)out.size();
+	} );
+
+	if ( app->verbose && previousChunks )
+		std::println( "Reused {} of {} chunks from {}", reusedChunks.load(), chunks.size(), filename );
+
+	auto align = [ dataAlignment ]( u64 value ) { return ( value + dataAlignment - 1 ) & ~( dataAlignment - 1 ); };
+
+	u64 offset = sizeof( TexpackContainerHeader ) + mips.size() * sizeof( TexpackContainerMip ) + chunks.size() * sizeof( TexpackContainerChunk );
+
+	for ( TexpackContainerMip &mip : mips )
+	{
+		offset = align( offset );
+		mip.offset = offset;
+		mip.dataSize = 0;
+
+		for ( u32 c = mip.firstChunk; c < mip.firstChunk + mip.chunkCount; ++c )
+		{
+			chunks[ c ].offset = offset;
+			offset += chunks[ c ].size;
+			mip.dataSize += chunks[ c ].size;
+		}
+	}
+
+	offset = align( offset );
+
+	TexpackContainerHeader header =
+	{
+		.magicNumber = 'CxeT',
+		.majorVersion = VERSION_MAJOR,
+		.minorVersion = VERSION_MINOR,
+		.revisionVersion = VERSION_REVISION,
+		.pixelFormat = pixelFormat,
+		.codec = codec,
+		.size = { layers[ 0 ].width, layers[ 0 ].height },
+		.layerCount = layerCount,
+		.mipCount = mipCount,
+		.chunkSize = chunkSize,
+		.chunkCount = (u32)chunks.size(),
+		.datOffset = dat ? offset : 0,
+		.datSize = dat ? dat->size() : 0,
+	};
+
+	std::ofstream file( filename, std::ios::binary );
+	if ( !file.good() )
+		return false;
+
+	auto pad_to = [ &file ]( u64 position )
+	{
+		static const char zeros[ dataAlignment ] = {};
+		u64 current = (u64)file.tellp();
+		file.write( zeros, position - current );
+	};
+
+	file.write( (char*)&header, sizeof( header ) );
+	file.write( (char*)mips.data(), mips.size() * sizeof( TexpackContainerMip ) );
+	file.write( (char*)chunks.data(), chunks.size() * sizeof( TexpackContainerChunk ) );
+
+	for ( const TexpackContainerMip &mip : mips )
+	{
+		pad_to( mip.offset );
+
+		for ( u32 c = mip.firstChunk; c < mip.firstChunk + mip.chunkCount; ++c )
+			file.write( (char*)chunkData[ c ].data(), chunkData[ c ].size() );
+	}
+
+	if ( dat )
+	{
+		pad_to( header.datOffset );
+		file.write( dat->data(), dat->size() );
+	}
+
+	return file.good();
+}
+
+// The tiles of its layer the frames of a sprite cover, as indices into the page table of that layer.
+static void sprite_tiles( TexpackSpriteNamed *spr, Data *data )
+{
+	f32 tw = (f32)data->textureWidth;
+	f32 th = (f32)data->textureHeight;
+	i32 tileSize = data->tileSize;
+	i32 tilesX = ( data->textureWidth + tileSize - 1 ) / tileSize;
+
+	spr->tiles.clear();
+
+	for ( const TexpackFrame &frame : spr->frames )
+	{
+		i32 x0 = (i32)lroundf( frame.uvs.x * tw );
+		i32 y0 = (i32)lroundf( frame.uvs.y * th );
+		i32 x1 = (i32)lroundf( frame.uvs.z * tw );
+		i32 y1 = (i32)lroundf( frame.uvs.w * th );
+
+		if ( x1 <= x0 || y1 <= y0 )
+			continue;
+
+		for ( i32 ty = y0 / tileSize; ty <= ( y1 - 1 ) / tileSize; ++ty )
+			for ( i32 tx = x0 / tileSize; tx <= ( x1 - 1 ) / tileSize; ++tx )
+				spr->tiles.push_back( (u32)( ty * tilesX + tx ) );
+	}
+
+	std::sort( spr->tiles.begin(), spr->tiles.end() );
+	spr->tiles.erase( std::unique( spr->tiles.begin(), spr->tiles.end() ), spr->tiles.end() );
+	spr->sprite.tileCount = (u32)spr->tiles.size();
+}
+
+// Copies a tile and its gutter out of a layer, the gutter repeats the edge pixels outside the layer.
+static void extract_tile( const ContainerLayer &layer, i32 tx, i32 ty, i32 tileSize, i32 gutter, i32 channels, u8 *out )
+{
+	i32 stride = tileSize + gutter * 2;
+	i32 x0 = tx * tileSize - gutter;
+	i32 y0 = ty * tileSize - gutter;
+	i32 xBegin = max_value( x0, 0 );
+	i32 xEnd = min_value( x0 + stride, layer.width );
+
+	for ( i32 y = 0; y < stride; ++y )
+	{
+		i32 sy = min_value( max_value( y0 + y, 0 ), layer.height - 1 );
+		const u8 *row = layer.pixels + (u64)sy * layer.width * channels;
+		u8 *dst = out + (u64)y * stride * channels;
+
+		for ( i32 x = x0; x < xBegin; ++x )
+			memcpy( dst + ( x - x0 ) * channels, row, channels );
+
+		memcpy( dst + ( xBegin - x0 ) * channels, row + (u64)xBegin * channels, (u64)( xEnd - xBegin ) * channels );
+
+		for ( i32 x = xEnd; x < x0 + stride; ++x )
+			memcpy( dst + ( x - x0 ) * channels, row + (u64)( layer.width - 1 ) * channels, channels );
+	}
+}
+
+// Virtual texture tile pack, see README.md for the layout. Every layer is cut into tiles with a gutter,
+// identical tiles ( empty space, repeated sprites ) are stored once and the page table maps
+// every tile of every layer to its stored tile.
+static bool write_tile_pack( const std::string &filename, const ContainerLayer *layers, u16 layerCount, const std::string *dat, App *app, Data *data )
+{
+	constexpr u64 dataAlignment = 16;
+
+	i32 channels = data->outputChannels;
+	i32 tileSize = data->tileSize;
+	i32 gutter = data->tileGutter;
+	i32 stride = tileSize + gutter * 2;
+	u64 tileBytes = (u64)stride * stride * channels;
+	i32 tilesX = ( data->textureWidth + tileSize - 1 ) / tileSize;
+	i32 tilesY = ( data->textureHeight + tileSize - 1 ) / tileSize;
+	u32 tilesPerLayer = (u32)( tilesX * tilesY );
+	u32 tileCount = tilesPerLayer * layerCount;
+
+	auto extract = [ & ]( u32 page, u8 *out )
+	{
+		u32 tile = page % tilesPerLayer;
+		extract_tile( layers[ page / tilesPerLayer ], (i32)( tile % tilesX ), (i32)( tile / tilesX ), tileSize, gutter, channels, out );
+	};
+
+	// one row of tiles per job so the buffer is reused
+	std::vector<u64> hashes( tileCount );
+
+	parallel_for( (u32)( layerCount * tilesY ), [ & ]( u32 row )
+	{
+		std::vector<u8> tile( tileBytes );
+
+		for ( u32 page = row * tilesX, end = page + tilesX; page < end; ++page )
+		{
+			extract( page, tile.data() );
+			hashes[ page ] = hash_bytes( tile.data(), tileBytes );
+		}
+	} );
+
+	std::vector<u32> pageTable( tileCount );
+	std::vector<u32> uniquePages;
+	std::unordered_multimap<u64, u32> uniqueByHash;
+	std::vector<u8> tile( tileBytes );
+	std::vector<u8> other( tileBytes );
+
+	for ( u32 page = 0; page < tileCount; ++page )
+	{
+		u32 unique = UINT32_MAX;
+		auto [ begin, end ] = uniqueByHash.equal_range( hashes[ page ] );
+
+		if ( begin != end )
+			extract( page, tile.data() );
+
+		for ( auto iter = begin; iter != end && unique == UINT32_MAX; ++iter )
+		{
+			extract( uniquePages[ iter->second ], other.data() );
+			if ( memcmp( tile.data(), other.data(), tileBytes ) == 0 )
+				unique = iter->second;
+		}
+
+		if ( unique == UINT32_MAX )
+		{
+			unique = (u32)uniquePages.size();
+			uniquePages.push_back( page );
+			uniqueByHash.emplace( hashes[ page ], unique );
+		}
+
+		pageTable[ page ] = unique;
+	}
+
+	std::vector<TexpackTile> tiles( uniquePages.size() );
+	std::vector<std::vector<u8>> tileData( uniquePages.size() );
+
+	parallel_for( (u32)uniquePages.size(), [ & ]( u32 unique )
+	{
+		std::vector<u8> raw( tileBytes );
+		std::vector<u8> &out = tileData[ unique ];
+
+		extract( uniquePages[ unique ], raw.data() );
+
+		switch ( data->codec )
+		{
+		case TEXTURE_CODEC_NONE:
+			out = std::move( raw );
+			break;
+
+		case TEXTURE_CODEC_LZ4:
+			out.resize( lz_compress_bound( (u32)tileBytes ) );
+			out.resize( lz_compress( raw.data(), (u32)tileBytes, out.data() ) );
+			break;
+
+		case TEXTURE_CODEC_QOI:
+			out.resize( qoi_encode_bound( stride, stride ) );
+			out.resize( qoi_encode( raw.data(), stride, stride, 4, out.data() ) );
+			break;
+		}
+
+		tiles[ unique ].size = (u32)out.size();
+	} );
+
+	auto align = [ dataAlignment ]( u64 value ) { return ( value + dataAlignment - 1 ) & ~( dataAlignment - 1 ); };
+
+	u64 offset = align( sizeof( TexpackTileHeader ) + pageTable.size() * sizeof( u32 ) + tiles.size() * sizeof( TexpackTile ) );
+
+	for ( TexpackTile &entry : tiles )
+	{
+		entry.offset = offset;
+		offset += entry.size;
+	}
+
+	offset = align( offset );
+
+	TexpackTileHeader header =
+	{
+		.magicNumber = 'VxeT',
+		.majorVersion = VERSION_MAJOR,
+		.minorVersion = VERSION_MINOR,
+		.revisionVersion = VERSION_REVISION,
+		.pixelFormat = PIXEL_FORMAT_RGBA8,
+		.codec = data->codec,
+		.size = { data->textureWidth, data->textureHeight },
+		.layerCount = layerCount,
+		.tileSize = (u16)tileSize,
+		.gutter = (u16)gutter,
+		.reserved = 0,
+		.tileCount = { tilesX, tilesY },
+		.uniqueTileCount = (u32)tiles.size(),
+		.datOffset = dat ? offset : 0,
+		.datSize = dat ? dat->size() : 0,
+	};
+
+	if ( app->verbose )
+		std::println( "Storing {} unique of {} tiles: {}", tiles.size(), tileCount, filename );
+
+	std::ofstream file( filename, std::ios::binary );
+	if ( !file.good() )
+		return false;
+
+	auto pad_to = [ &file ]( u64 position )
+	{
+		static const char zeros[ dataAlignment ] = {};
+		u64 current = (u64)file.tellp();
+		file.write( zeros, position - current );
+	};
+
+	file.write( (char*)&header, sizeof( header ) );
+	file.write( (char*)pageTable.data(), pageTable.size() * sizeof( u32 ) );
+	file.write( (char*)tiles.data(), tiles.size() * sizeof( TexpackTile ) );
+
+	if ( !tiles.empty() )
+		pad_to( tiles[ 0 ].offset );
+
+	for ( const std::vector<u8> &bytes : tileData )
+		file.write( (char*)bytes.data(), bytes.size() );
+
+	if ( dat )
+	{
+		pad_to( header.datOffset );
+		file.write( dat->data(), dat->size() );
+	}
+
+	return file.good();
+}
+
+// FNV-1a with a seed, the generated header carries the same function.
+static constexpr u32 name_hash( std::string_view name, u32 seed )
+{
+	u32 hash = 2166136261u ^ seed;
+	for ( char c : name )
+	{
+		hash ^= (u8)c;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+struct PerfectHash
+{
+	std::vector<u32> displacements;
+	std::vector<u32> slots;
+};
+
+// Hash and displace. Keys are bucketed by name_hash( name, 0 ), then largest buckets first
+// each bucket searches for a seed that drops all of its keys into free slots.
+static bool build_perfect_hash( const std::vector<TexpackSpriteNamed> &sprites, PerfectHash *perfectHash )
+{
+	u32 count = (u32)sprites.size();
+	u32 bucketCount = max_value( ( count + 3 ) / 4, 1u );
+	u32 slotCount = max_value( count + count / 4, 1u );
+
+	std::vector<std::vector<u32>> buckets( bucketCount );
+	for ( u32 i = 0; i < count; ++i )
+		buckets[ name_hash( sprites[ i ].name, 0 ) % bucketCount ].push_back( i );
+
+	std::vector<u32> order( bucketCount );
+	for ( u32 i = 0; i < bucketCount; ++i )
+		order[ i ] = i;
+
+	std::stable_sort( order.begin(), order.end(), [ &buckets ]( u32 l, u32 r ) { return buckets[ l ].size() > buckets[ r ].size(); } );
+
+	perfectHash->displacements.assign( bucketCount, 0 );
+	perfectHash->slots.assign( slotCount, count );
+
+	std::vector<u32> candidate;
+
+	for ( u32 bucket : order )
+	{
+		if ( buckets[ bucket ].empty() )
+			break;
+
+		bool placed = false;
+
+		for ( u32 seed = 1; seed < ( 1u << 24 ) && !placed; ++seed )
+		{
+			candidate.clear();
+			placed = true;
+
+			for ( u32 key : buckets[ bucket ] )
+			{
+				u32 slot = name_hash( sprites[ key ].name, seed ) % slotCount;
+
+				if ( perfectHash->slots[ slot ] != count || std::find( candidate.begin(), candidate.end(), slot ) != candidate.end() )
+				{
+					placed = false;
+					break;
+				}
+
+				candidate.push_back( slot );
+			}
+
+			if ( placed )
+			{
+				perfectHash->displacements[ bucket ] = seed;
+				for ( u64 k = 0; k < candidate.size(); ++k )
+					perfectHash->slots[ candidate[ k ] ] = buckets[ bucket ][ k ];
+			}
+		}
+
+		if ( !placed )
+			return false;
+	}
+
+	return true;
+}
+
+static constexpr std::string_view cppKeywords[] =
+{
+	"alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "break", "case", "catch", "char",
+	"char8_t", "char16_t", "char32_t", "class", "compl", "concept", "const", "consteval", "constexpr", "constinit",
+	"const_cast", "continue", "co_await", "co_return", "co_yield", "decltype", "default", "delete", "do", "double",
+	"dynamic_cast", "else", "enum", "explicit", "export", "extern", "false", "float", "for", "friend", "goto", "if",
+	"inline", "int", "long", "mutable", "namespace", "new", "noexcept", "not", "not_eq", "nullptr", "operator", "or",
+	"or_eq", "private", "protected", "public", "register", "reinterpret_cast", "requires", "return", "short", "signed",
+	"sizeof", "static", "static_assert", "static_cast", "struct", "switch", "template", "this", "thread_local", "throw",
+	"true", "try", "typedef", "typeid", "typename", "union", "unsigned", "using", "virtual", "void", "volatile",
+	"wchar_t", "while", "xor", "xor_eq",
+};
+
+// names the header declares in namespace texpack or uses unqualified, a group namespace of the same name would hide them
+static constexpr std::string_view cppHeaderNames[] =
+{
+	"ChannelUsage", "Collider", "ColliderType", "IVec2", "IVec4", "Opacity", "Vec4", "int32_t", "name_hash", "std",
+	"uint16_t", "uint32_t", "uint64_t", "uint8_t",
+};
+
+// Replaces the characters that can not be in an identifier with _, keywords get a _ suffix.
+static std::string cpp_identifier( std::string_view name )
+{
+	std::string identifier;
+	identifier.reserve( name.size() + 2 );
+
+	if ( name.empty() || ( name[ 0 ] >= '0' && name[ 0 ] <= '9' ) )
+		identifier += '_';
+
+	for ( char c : name )
+	{
+		bool valid = ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || ( c >= '0' && c <= '9' ) || c == '_';
+		identifier += valid ? c : '_';
+	}
+
+	if ( std::find( std::begin( cppKeywords ), std::end( cppKeywords ), identifier ) != std::end( cppKeywords ) )
+		identifier += '_';
+
+	return identifier;
+}
+
+static std::string cpp_float( f32 value )
+{
+	char buffer[ 32 ];
+	auto [ ptr, ec ] = std::to_chars( buffer, buffer + sizeof( buffer ), value );
+	std::string_view text( buffer, ptr - buffer );
+	bool needsPoint = text.find_first_of( ".en" ) == std::string_view::npos;
+	return std::string( text ) + ( needsPoint ? ".0f" : "f" );
+}
+
+// Header mirroring the .dat, so sprites can be compiled in and looked up by id.
+static bool write_cpp_header( const std::string &filename, const std::string &textureName, const std::string &textureFile, const Output *output, App *app, Data *data )
+{
+	const std::vector<TexpackSpriteNamed> &sprites = output->sprites;
+
+	u32 count = (u32)sprites.size();
+
+	// the first sprite to use an identifier keeps it, the others take the lowest _N suffix that no sprite uses
+	std::unordered_set<std::string> identifiers = { "Count" };
+	std::vector<std::string> enumNames( count );
+	std::vector<u32> clashes;
+
+	for ( u32 i = 0; i < count; ++i )
+	{
+		enumNames[ i ] = cpp_identifier( sprites[ i ].name );
+
+		if ( !identifiers.insert( enumNames[ i ] ).second )
+			clashes.push_back( i );
+	}
+
+	for ( u32 i : clashes )
+	{
+		u32 suffix = 1;
+		while ( identifiers.contains( std::format( "{}_{}", enumNames[ i ], suffix ) ) )
+			++suffix;
+
+		enumNames[ i ] = std::format( "{}_{}", enumNames[ i ], suffix );
+		identifiers.insert( enumNames[ i ] );
+	}
+
+	PerfectHash perfectHash;
+	if ( !build_perfect_hash( sprites, &perfectHash ) )
+	{
+		std::println( stderr, "Failed to build the sprite name hash for {}, are there duplicate sprite names?", textureName );
+		app->problems += 1;
+		return true;
+	}
+
+	std::string out;
+	out.reserve( 64 * 1024 );
+
+	auto line = [ &out ]( std::string_view text )
+	{
+		out += text;
+		out += '\n';
+	};
+
+	u32 colliderTotal = (u32)output->colliders.size();
+	u64 maskTotal = 0;
+
+	for ( const GenCollisionData &col : output->colliders )
+		maskTotal += col.mask.size();
+
+	std::string ns = cpp_identifier( textureName );
+
+	if ( std::find( std::begin( cppHeaderNames ), std::end( cppHeaderNames ), ns ) != std::end( cppHeaderNames ) )
+		ns += '_';
+	std::string names;
+	std::string uvs;
+	std::string sizes;
+	std::string origins;
+	std::string frameCounts;
+	std::string translucent;
+	std::string opacities;
+	std::string rotated;
+	std::string nineslices;
+	std::string layers;
+	std::string atlases;
+	std::string channelUsages;
+	std::string frameOffsets;
+	std::string frameUVs;
+	std::string frameRotated;
+	std::string frameOpacities;
+	std::string colliderOffsets;
+	std::string colliderCounts;
+	std::string colliders;
+	std::string masks;
+
+	u32 colliderOffset = 0;
+	u32 frameOffset = 0;
+	u64 maskOffset = 0;
+
+	constexpr std::string_view opacityNames[ OPACITY_COUNT ] = { "Opaque", "Cutout", "Blend" };
+	constexpr std::string_view channelUsageNames[ CHANNEL_USAGE_COUNT ] = { "RGBA", "RGB", "Gray", "Alpha" };
+
+	for ( u32 i = 0; i < count; ++i )
+	{
+		const TexpackSprite &spr = sprites[ i ].sprite;
+
+		std::string escaped;
+		for ( char c : sprites[ i ].name )
+		{
+			if ( c == '"' || c == '\\' )
+				escaped += '\\';
+			escaped += c;
+		}
+
+		names += std::format( "\t\t\"{}\",\n", escaped );
+		uvs += std::format( "\t\t{{ {}, {}, {}, {} }},\n", cpp_float( spr.uvs.x ), cpp_float( spr.uvs.y ), cpp_float( spr.uvs.z ), cpp_float( spr.uvs.w ) );
+		sizes += std::format( "\t\t{{ {}, {} }},\n", spr.size.x, spr.size.y );
+		origins += std::format( "\t\t{{ {}, {} }},\n", spr.origin.x, spr.origin.y );
+		frameCounts += std::format( "{}, ", spr.frameCount );
+		translucent += spr.isTranslucent ? "true, " : "false, ";
+		opacities += std::format( "texpack::Opacity::{}, ", opacityNames[ spr.opacity ] );
+		rotated += spr.isRotated ? "true, " : "false, ";
+		nineslices += std::format( "{}, ", spr.nineslice );
+		layers += std::format( "{}, ", spr.layer );
+		atlases += std::format( "{}, ", spr.atlas );
+		channelUsages += std::format( "texpack::ChannelUsage::{}, ", channelUsageNames[ spr.channelUsage ] );
+		frameOffsets += std::format( "{}, ", frameOffset );
+		colliderOffsets += std::format( "{}, ", colliderOffset );
+
+		for ( const TexpackFrame &frame : sprites[ i ].frames )
+		{
+			frameUVs += std::format( "\t\t{{ {}, {}, {}, {} }},\n", cpp_float( frame.uvs.x ), cpp_float( frame.uvs.y ), cpp_float( frame.uvs.z ), cpp_float( frame.uvs.w ) );
+			frameRotated += frame.isRotated ? "true, " : "false, ";
+		}
+
+		for ( u8 opacity : sprites[ i ].frameOpacity )
+			frameOpacities += std::format( "texpack::Opacity::{}, ", opacityNames[ opacity ] );
+
+		frameOffset += (u32)sprites[ i ].frames.size();
+		colliderCounts += std::format( "{}, ", spr.colliderCount );
+
+		for ( u32 c = 0; c < spr.colliderCount; ++c )
+		{
+			const GenCollisionData &col = output->colliders[ sprites[ i ].firstCollider + c ];
+
+			switch ( col.type )
+			{
+			case GEN_COLLISION_DATA_TYPE_RECT_AUTO:
+			case GEN_COLLISION_DATA_TYPE_RECT_FULL:
+			case GEN_COLLISION_DATA_TYPE_RECT_MANUAL:
+				colliders += std::format( "\t\t{{ texpack::ColliderType::Rect, {{ {}, {}, {}, {} }}, {{}}, 0, {{}}, 0 }},\n", col.area.x, col.area.y, col.area.z, col.area.w );
+				break;
+
+			case GEN_COLLISION_DATA_TYPE_CIRCLE_AUTO:
+			case GEN_COLLISION_DATA_TYPE_CIRCLE_AUTO_ENCOMPASS:
+			case GEN_COLLISION_DATA_TYPE_CIRCLE_MANUAL:
+				colliders += std::format( "\t\t{{ texpack::ColliderType::Circle, {{}}, {{ {}, {} }}, {}, {{}}, 0 }},\n", col.position.x, col.position.y, col.radius );
+				break;
+
+			case GEN_COLLISION_DATA_TYPE_MASK:
+				colliders += std::format( "\t\t{{ texpack::ColliderType::Mask, {{}}, {{}}, 0, {{ {}, {} }}, {} }},\n", col.maskSize.x, col.maskSize.y, maskOffset );
+				for ( u64 w = 0; w < col.mask.size(); ++w )
+					masks += std::format( "{}0x{:016x}ull,{}", w % 4 == 0 ? "\t\t" : "", col.mask[ w ], w % 4 == 3 ? "\n" : " " );
+				if ( col.mask.size() % 4 != 0 )
+					masks += "\n";
+				maskOffset += col.mask.size();
+				break;
+			}
+		}
+
+		colliderOffset += spr.colliderCount;
+	}
+
+	line( std::format( "// Generated by texpack {}.{}.{} from {}, do not edit.", VERSION_MAJOR, VERSION_MINOR, VERSION_REVISION, textureName ) );
+	line( "" );
+	line( "#pragma once" );
+	line( "" );
+	line( "#include <cstdint>" );
+	line( "#include <string_view>" );
+	line( "" );
+	line( "#ifndef TEXPACK_SPRITE_TYPES" );
+	line( "#define TEXPACK_SPRITE_TYPES" );
+	line( "" );
+	line( "namespace texpack" );
+	line( "{" );
+	line( "\tstruct Vec4 { float x, y, z, w; };" );
+	line( "\tstruct IVec2 { int32_t x, y; };" );
+	line( "\tstruct IVec4 { int32_t x, y, z, w; };" );
+	line( "" );
+	line( "\tenum class ColliderType : uint8_t { Circle, Rect, Mask };" );
+	line( "\tenum class Opacity : uint8_t { Opaque, Cutout, Blend };" );
+	line( "\tenum class ChannelUsage : uint8_t { RGBA, RGB, Gray, Alpha };" );
+	line( "" );
+	line( "\t// area is set for Rect, position and radius for Circle, maskSize and maskOffset ( into masks ) for Mask" );
+	line( "\tstruct Collider" );
+	line( "\t{" );
+	line( "\t\tColliderType type;" );
+	line( "\t\tIVec4 area;" );
+	line( "\t\tIVec2 position;" );
+	line( "\t\tint32_t radius;" );
+	line( "\t\tIVec2 maskSize;" );
+	line( "\t\tuint32_t maskOffset;" );
+	line( "\t};" );
+	line( "" );
+	line( "\tconstexpr uint32_t name_hash( std::string_view name, uint32_t seed )" );
+	line( "\t{" );
+	line( "\t\tuint32_t hash = 2166136261u ^ seed;" );
+	line( "\t\tfor ( char c : name )" );
+	line( "\t\t{" );
+	line( "\t\t\thash ^= (uint8_t)c;" );
+	line( "\t\t\thash *= 16777619u;" );
+	line( "\t\t}" );
+	line( "\t\treturn hash;" );
+	line( "\t}" );
+	line( "}" );
+	line( "" );
+	line( "#endif" );
+	line( "" );
+	line( std::format( "namespace texpack::{}", ns ) );
+	line( "{" );
+	line( std::format( "\tinline constexpr std::string_view texture = \"{}\";", textureFile ) );
+	line( std::format( "\tinline constexpr IVec2 textureSize = {{ {}, {} }};", data->textureWidth, data->textureHeight ) );
+	line( "" );
+
+	// atlas 0 is the texture, the routed atlases follow it
+	u64 dot = textureFile.rfind( '.' );
+	std::string atlasTextures = std::format( "\"{}\", ", textureFile );
+	std::string atlasSizes = std::format( "{{ {}, {} }}, ", data->textureWidth, data->textureHeight );
+
+	for ( const OutputAtlas &atlas : output->atlases )
+	{
+		atlasTextures += std::format( "\"{}{}{}\", ", textureFile.substr( 0, dot ), atlas.suffix, textureFile.substr( dot ) );
+		atlasSizes += std::format( "{{ {}, {} }}, ", atlas.width, atlas.height );
+	}
+
+	line( std::format( "\tinline constexpr std::string_view atlasTextures[ {} ] = {{ {}}};", 1 + output->atlases.size(), atlasTextures ) );
+	line( std::format( "\tinline constexpr IVec2 atlasSizes[ {} ] = {{ {}}};", 1 + output->atlases.size(), atlasSizes ) );
+	line( "" );
+	line( "\tenum class SpriteId : uint32_t" );
+	line( "\t{" );
+	for ( u32 i = 0; i < count; ++i )
+		line( std::format( "\t\t{},", enumNames[ i ] ) );
+	line( "\t\tCount" );
+	line( "\t};" );
+	line( "" );
+
+	u32 arraySize = max_value( count, 1u );
+
+	auto array = [ &line, arraySize ]( std::string_view type, std::string_view name, const std::string &values, bool multiline )
+	{
+		if ( multiline )
+		{
+			line( std::format( "\tinline constexpr {} {}[ {} ] =", type, name, arraySize ) );
+			line( "\t{" );
+			line( std::string_view( values ).substr( 0, values.empty() ? 0 : values.size() - 1 ) );
+			line( "\t};" );
+		}
+		else
+		{
+			line( std::format( "\tinline constexpr {} {}[ {} ] = {{ {}}};", type, name, arraySize, values ) );
+		}
+	};
+
+	array( "std::string_view", "names", names, true );
+	array( "Vec4", "uvs", uvs, true );
+	array( "IVec2", "sizes", sizes, true );
+	array( "IVec2", "origins", origins, true );
+	array( "int32_t", "frameCounts", frameCounts, false );
+	array( "bool", "isTranslucent", translucent, false );
+	array( "Opacity", "opacities", opacities, false );
+	array( "bool", "isRotated", rotated, false );
+	array( "uint16_t", "nineslices", nineslices, false );
+	array( "uint16_t", "layers", layers, false );
+	array( "uint8_t", "atlases", atlases, false );
+	array( "ChannelUsage", "channelUsages", channelUsages, false );
+	array( "uint32_t", "frameOffsets", frameOffsets, false );
+	array( "uint32_t", "colliderOffsets", colliderOffsets, false );
+	array( "uint8_t", "colliderCounts", colliderCounts, false );
+	line( "" );
+	line( std::format( "\tinline constexpr Vec4 frameUVs[ {} ] =", max_value( frameOffset, 1u ) ) );
+	line( "\t{" );
+	out += frameUVs.empty() ? "\t\t{},\n" : frameUVs;
+	line( "\t};" );
+	line( std::format( "\tinline constexpr bool frameRotated[ {} ] = {{ {}}};", max_value( frameOffset, 1u ), frameRotated ) );
+	line( std::format( "\tinline constexpr Opacity frameOpacities[ {} ] = {{ {}}};", max_value( frameOffset, 1u ), frameOpacities ) );
+	line( "" );
+	line( std::format( "\tinline constexpr Collider colliders[ {} ] =", max_value( colliderTotal, 1u ) ) );
+	line( "\t{" );
+	out += colliders.empty() ? "\t\t{ texpack::ColliderType::Rect, {}, {}, 0, {}, 0 },\n" : colliders;
+	line( "\t};" );
+	line( "" );
+	line( std::format( "\tinline constexpr uint64_t masks[ {} ] =", max_value( maskTotal, (u64)1 ) ) );
+	line( "\t{" );
+	out += masks.empty() ? "\t\t0,\n" : masks;
+	line( "\t};" );
+	line( "" );
+	line( "\tnamespace detail" );
+	line( "\t{" );
+
+	std::string displacements;
+	for ( u32 d : perfectHash.displacements )
+		displacements += std::format( "{}, ", d );
+
+	std::string slots;
+	for ( u32 slot : perfectHash.slots )
+		slots += std::format( "{}, ", slot );
+
+	line( std::format( "\t\tinline constexpr uint32_t displacements[ {} ] = {{ {}}};", perfectHash.displacements.size(), displacements ) );
+	line( std::format( "\t\tinline constexpr uint32_t slots[ {} ] = {{ {}}};", perfectHash.slots.size(), slots ) );
+	line( "\t}" );
+	line( "" );
+	line( "\t// SpriteId::Count when the name is not in the group" );
+	line( "\tconstexpr SpriteId find( std::string_view name )" );
+	line( "\t{" );
+	line( std::format( "\t\tuint32_t displacement = detail::displacements[ name_hash( name, 0 ) % {} ];", perfectHash.displacements.size() ) );
+	line( std::format( "\t\tuint32_t slot = detail::slots[ name_hash( name, displacement ) % {} ];", perfectHash.slots.size() ) );
+	line( "\t\treturn slot < (uint32_t)SpriteId::Count && names[ slot ] == name ? (SpriteId)slot : SpriteId::Count;" );
+	line( "\t}" );
+	line( "}" );
+
+	std::ofstream file( filename, std::ios::binary );
+	file.write( out.data(), out.size() );
+
+	return file.good();
+}
+
+// One frame of a sprite going into the atlas, offX and offY are the upright frame top left.
+struct CompositeBlit
+{
+	const Image *diffuse;
+	const Image *normal;
+	const Image *emissive;
+	u32 sprite;
+	i32 frame;
+	i32 offX;
+	i32 offY;
+	i32 frameW;
+	i32 frameH;
+	i32 inputW;
+	bool isRotated;
+};
+
+// Packed rects never overlap, so the atlas is split into bands of rows and each band is filled
+// and given the parts of the frames crossing it by one thread, no locks needed.
+static void composite_bands( std::vector<u8> &diffuseImage, std::vector<u8> &normalImage, std::vector<u8> &emissiveImage, const std::vector<CompositeBlit> &blits, Data *data )
+{
+	constexpr i32 bandHeight = 32;
+
+	i32 bandCount = ( data->textureHeight + bandHeight - 1 ) / bandHeight;
+
+	std::vector<std::vector<u32>> bands( bandCount );
+
+	for ( u32 i = 0, count = (u32)blits.size(); i < count; ++i )
+	{
+		const CompositeBlit &blit = blits[ i ];
+		i32 height = blit.isRotated ? blit.frameW : blit.frameH;
+
+		if ( height <= 0 )
+			continue;
+
+		for ( i32 band = blit.offY / bandHeight, last = ( blit.offY + height - 1 ) / bandHeight; band <= last; ++band )
+			bands[ band ].push_back( i );
+	}
+
+	const u8 diffuseFill[ 4 ] = { 255, 0, 255, 0 };	// magenta - although if alpha is respected it wont be seen
+	const u8 normalFill[ 4 ] = { 128, 128, 255, 255 };
+
+	parallel_for( (u32)bandCount, [ & ]( u32 band )
+	{
+		i32 rowBegin = (i32)band * bandHeight;
+		i32 rowEnd = min_value( rowBegin + bandHeight, data->textureHeight );
+		u64 first = (u64)rowBegin * data->textureWidth * data->outputChannels;
+		u64 pixelCount = (u64)( rowEnd - rowBegin ) * data->textureWidth;
+
+		// emissive is already cleared to zero
+		fill_pixels( &diffuseImage[ first ], pixelCount, diffuseFill );
+		fill_pixels( &normalImage[ first ], pixelCount, normalFill );
+
+		// left to right so the writes walk along the rows
+		std::vector<u32> &order = bands[ band ];
+		std::sort( order.begin(), order.end(), [ &blits ]( u32 l, u32 r ) { return blits[ l ].offX < blits[ r ].offX; } );
+
+		for ( u32 i : order )
+		{
+			const CompositeBlit &blit = blits[ i ];
+
+			RenderFunc render = blit.isRotated ? render_image_transposed : render_image_for( blit.frameW, blit.diffuse->channels );
+
+			render( diffuseImage, blit.offX, blit.offY, blit.frameW, blit.frameH, blit.diffuse->img, blit.frame, blit.inputW, blit.diffuse->channels, rowBegin, rowEnd, data );
+
+			if ( blit.normal )
+				render( normalImage, blit.offX, blit.offY, blit.frameW, blit.frameH, blit.normal->img, blit.frame, blit.inputW, blit.normal->channels, rowBegin, rowEnd, data );
+
+			if ( blit.emissive )
+				render( emissiveImage, blit.offX, blit.offY, blit.frameW, blit.frameH, blit.emissive->img, blit.frame, blit.inputW, blit.emissive->channels, rowBegin, rowEnd, data );
+		}
+	} );
+}
+
+// Copies the frames of the routed sprites into their atlases, keeping the channels the atlas stores.
+// Gray keeps R, alpha keeps A and RGB the first three. Frames never overlap so they are copied in parallel.
+static void render_routed( std::vector<OutputAtlas> &atlases, const std::vector<CompositeBlit> &blits, const std::pmr::vector<TexpackSpriteNamed> &sprites )
+{
+	parallel_for( (u32)blits.size(), [ & ]( u32 i )
+	{
+		const CompositeBlit &blit = blits[ i ];
+		const TexpackSprite &sprite = sprites[ blit.sprite ].sprite;
+
+		if ( sprite.atlas == 0 )
+			return;
+
+		OutputAtlas &atlas = atlases[ sprite.atlas - 1 ];
+		u32 first = sprite.channelUsage == CHANNEL_USAGE_ALPHA ? 3 : 0;
+		i32 channels = blit.diffuse->channels;
+
+		for ( i32 y = 0; y < blit.frameH; ++y )
+		{
+			for ( i32 x = 0; x < blit.frameW; ++x )
+			{
+				i32 toX = blit.offX + ( blit.isRotated ? y : x );
+				i32 toY = blit.offY + ( blit.isRotated ? x : y );
+				u64 to = ( (u64)toX + (u64)toY * atlas.width ) * atlas.channels;
+				u64 from = ( (u64)x + (u64)blit.frame * blit.frameW + (u64)y * blit.inputW ) * channels;
+
+				memcpy( &atlas.pixels[ to ], &blit.diffuse->img[ from + first ], atlas.channels );
+			}
+		}
+	} );
+}
+
+// Gives the fully transparent texels of a w x h region the colour of the nearest texels with alpha, one ring
+// at a time, each texel the average of its 8 neighbours filled in the rings before. Alpha is not touched and
+// the other layers follow the alpha of the first. Regions with no alpha at all are left as they are.
+static void dilate_region( u8 *const *layers, u32 layerCount, i32 stride, i32 x0, i32 y0, i32 w, i32 h )
+{
+	enum : u8 { EMPTY, FILLED, QUEUED };
+
+	thread_local std::vector<u8> state;
+	thread_local std::vector<u32> ring;
+	thread_local std::vector<u32> next;
+
+	state.assign( (u64)w * h, FILLED );
+	ring.clear();
+
+	u64 emptyCount = 0;
+
+	for ( i32 y = 0; y < h; ++y )
+	{
+		const u8 *row = &layers[ 0 ][ ( (u64)( y0 + y ) * stride + x0 ) * 4 ];
+		u8 *rowState = &state[ (u64)y * w ];
+		i32 x = 0;
+
+#ifdef TEXPACK_SSE2
+		const __m128i alphaMask = _mm_set1_epi32( (i32)0xFF000000 );
+
+		for ( ; x + 4 <= w; x += 4 )
+		{
+			__m128i alpha = _mm_and_si128( _mm_loadu_si128( (const __m128i*)( row + x * 4 ) ), alphaMask );
+			u32 empty = (u32)_mm_movemask_epi8( _mm_cmpeq_epi32( alpha, _mm_setzero_si128() ) );
+
+			if ( empty == 0 )
+				continue;
+
+			for ( i32 i = 0; i < 4; ++i )
+			{
+				if ( empty & ( 1u << ( i * 4 ) ) )
+				{
+					rowState[ x + i ] = EMPTY;
+					emptyCount += 1;
+				}
+			}
+		}
+#endif
+
+		for ( ; x < w; ++x )
+		{
+			if ( row[ x * 4 + 3 ] == 0 )
+			{
+				rowState[ x ] = EMPTY;
+				emptyCount += 1;
+			}
+		}
+	}
+
+	if ( emptyCount == 0 || emptyCount == (u64)w * h )
+		return;
+
+	auto queue_neighbours = [ w, h ]( i32 x, i32 y, std::vector<u32> &out )
+	{
+		for ( i32 ny = max_value( y - 1, 0 ); ny <= min_value( y + 1, h - 1 ); ++ny )
+		{
+			for ( i32 nx = max_value( x - 1, 0 ); nx <= min_value( x + 1, w - 1 ); ++nx )
+			{
+				u32 cell = (u32)ny * w + nx;
+				if ( state[ cell ] == EMPTY )
+				{
+					state[ cell ] = QUEUED;
+					out.push_back( cell );
+				}
+			}
+		}
+	};
+
+	for ( i32 y = 0; y < h; ++y )
+	{
+		for ( i32 x = 0; x < w; ++x )
+		{
+			if ( state[ (u64)y * w + x ] == FILLED )
+				queue_neighbours( x, y, ring );
+		}
+	}
+
+	while ( !ring.empty() )
+	{
+		// the whole ring reads only earlier rings, so the order inside it does not matter
+		for ( u32 cell : ring )
+		{
+			i32 x = (i32)( cell % w );
+			i32 y = (i32)( cell / w );
+
+			for ( u32 layer = 0; layer < layerCount; ++layer )
+			{
+				u32 sum[ 3 ] = {};
+				u32 count = 0;
+
+				for ( i32 ny = max_value( y - 1, 0 ); ny <= min_value( y + 1, h - 1 ); ++ny )
+				{
+					for ( i32 nx = max_value( x - 1, 0 ); nx <= min_value( x + 1, w - 1 ); ++nx )
+					{
+						if ( state[ (u64)ny * w + nx ] != FILLED )
+							continue;
+
+						const u8 *px = &layers[ layer ][ ( (u64)( y0 + ny ) * stride + x0 + nx ) * 4 ];
+						sum[ 0 ] += px[ 0 ];
+						sum[ 1 ] += px[ 1 ];
+						sum[ 2 ] += px[ 2 ];
+						count += 1;
+					}
+				}
+
+				u8 *px = &layers[ layer ][ ( (u64)( y0 + y ) * stride + x0 + x ) * 4 ];
+				px[ 0 ] = (u8)( ( sum[ 0 ] + count / 2 ) / count );
+				px[ 1 ] = (u8)( ( sum[ 1 ] + count / 2 ) / count );
+				px[ 2 ] = (u8)( ( sum[ 2 ] + count / 2 ) / count );
+			}
+		}
+
+		for ( u32 cell : ring )
+			state[ cell ] = FILLED;
+
+		next.clear();
+
+		for ( u32 cell : ring )
+			queue_neighbours( (i32)( cell % w ), (i32)( cell / w ), next );
+
+		ring.swap( next );
+	}
+}
+
+// Dilates every frame with its padding on its own, so no colour crosses into another sprite.
+// Frames never overlap so they run in parallel.
+static void dilate_frames( std::vector<u8> &diffuseImage, std::vector<u8> &normalImage, std::vector<u8> &emissiveImage, const std::vector<CompositeBlit> &blits, Data *data )
+{
+	parallel_for( (u32)blits.size(), [ & ]( u32 i )
+	{
+		const CompositeBlit &blit = blits[ i ];
+		i32 padding = blit.diffuse->padding;
+
+		// nothing in an opaque frame without padding is transparent
+		if ( padding == 0 && blit.diffuse->alpha.known && blit.diffuse->alpha.opaque )
+			return;
+
+		u8 *layers[ 3 ] = { diffuseImage.data() };
+		u32 layerCount = 1;
+
+		if ( blit.normal )
+			layers[ layerCount++ ] = normalImage.data();
+
+		if ( blit.emissive )
+			layers[ layerCount++ ] = emissiveImage.data();
+
+		i32 w = ( blit.isRotated ? blit.frameH : blit.frameW ) + padding * 2;
+		i32 h = ( blit.isRotated ? blit.frameW : blit.frameH ) + padding * 2;
+
+		dilate_region( layers, layerCount, data->textureWidth, blit.offX - padding, blit.offY - padding, w, h );
+	} );
+}
+
+static std::string json_string( std::string_view text )
+{
+	std::string out = "\"";
+
+	for ( char c : text )
+	{
+		if ( c == '"' || c == '\\' )
+		{
+			out += '\\';
+			out += c;
+		}
+		else if ( (u8)c < 0x20 )
+		{
+			out += std::format( "\\u{:04x}", (u32)(u8)c );
+		}
+		else
+		{
+			out += c;
+		}
+	}
+
+	out += '"';
+	return out;
+}
+
+// Adds the packing result of a group to the plan report. Nothing was decoded, so the estimate counts
+// the packed pixels of every layer and assumes the empty space compresses away.
+static void plan_group( std::string_view name, const Output *array, u16 layer, const std::pmr::vector<TexpackSpriteNamed> &sprites,
+	const std::pmr::vector<stbrp_rect> &rects, const std::vector<u8> &rotated, bool packed, App *app, Data *data )
+{
+	constexpr u64 layerCount = 3;
+
+	u64 packedArea = 0;
+	u32 overflow = 0;
+	i32 usedHeight = 0;
+
+	for ( const stbrp_rect &rect : rects )
+	{
+		if ( rect.was_packed )
+		{
+			packedArea += (u64)rect.w * rect.h;
+			usedHeight = max_value( usedHeight, rect.y + rect.h );
+		}
+		else
+		{
+			overflow += 1;
+		}
+	}
+
+	u64 textureArea = (u64)data->textureWidth * data->textureHeight;
+	std::string &out = app->planGroups;
+
+	out += out.empty() ? "\t\t{\n" : ",\n\t\t{\n";
+	out += std::format( "\t\t\t\"name\": {},\n", json_string( name ) );
+
+	if ( array )
+		out += std::format( "\t\t\t\"array\": {},\n\t\t\t\"layer\": {},\n", json_string( array->name ), layer );
+
+	out += std::format( "\t\t\t\"packed\": {},\n", packed ? "true" : "false" );
+	out += std::format( "\t\t\t\"sprites\": {},\n", sprites.size() );
+	out += std::format( "\t\t\t\"rects\": {},\n", rects.size() );
+	out += std::format( "\t\t\t\"overflow\": {},\n", overflow );
+	out += std::format( "\t\t\t\"usedHeight\": {},\n", usedHeight );
+	out += std::format( "\t\t\t\"occupancy\": {:.4f},\n", textureArea ? (f64)packedArea / textureArea : 0.0 );
+	out += std::format( "\t\t\t\"rawTextureBytes\": {},\n", textureArea * data->outputChannels * layerCount );
+	out += std::format( "\t\t\t\"estimatedBytes\": {},\n", packedArea * data->outputChannels * layerCount );
+	out += "\t\t\t\"placements\":\n\t\t\t[\n";
+
+	for ( u64 i = 0, count = sprites.size(); i < count; ++i )
+	{
+		const TexpackSpriteNamed &spr = sprites[ i ];
+		u32 rectCount = spr.sprite.hasFrameUVs ? (u32)spr.sprite.frameCount : 1;
+
+		out += std::format( "\t\t\t\t{{ \"name\": {}, \"frames\": {}, \"rects\": [ ", json_string( spr.name ), spr.sprite.frameCount );
+
+		for ( u32 r = 0; r < rectCount; ++r )
+		{
+			const stbrp_rect &rect = rects[ spr.firstRect + r ];
+			const char *separator = r + 1 < rectCount ? ", " : " ";
+
+			if ( rect.was_packed )
+				out += std::format( "{{ \"x\": {}, \"y\": {}, \"w\": {}, \"h\": {}, \"rotated\": {} }}{}", rect.x, rect.y, rect.w, rect.h, rotated[ spr.firstRect + r ] ? "true" : "false", separator );
+			else
+				out += std::format( "{{ \"w\": {}, \"h\": {}, \"packed\": false }}{}", rect.w, rect.h, separator );
+		}
+
+		out += std::format( "] }}{}\n", i + 1 < count ? "," : "" );
+	}
+
+	out += "\t\t\t]\n\t\t}";
+
+	if ( overflow > 0 )
+	{
+		std::println( stderr, "Plan: {} overflows the {}x{} texture by {} of {} rects", name, data->textureWidth, data->textureHeight, overflow, rects.size() );
+		app->problems += 1;
+	}
+}
+
+static RESULT_CODE write_output( Output *output, App *app, Data *data );
+
+// When array is set the composited layers and sprites are added to it as the given layer instead of being written.
+// When page is set path is the input folder and the sprites of the page are read from its groups.
+RESULT_CODE process_texturegroup( const char *path, App *app, Data *data, Output *array, u16 layer, const UsagePage *page )
+{
+	if ( app->verbose )
+		std::println( "Processing: {}{}", page ? page->name : path, data->profileName.empty() ? "" : std::format( " ({})", data->profileName ) );
+
+	RESULT_CODE ret = RESULT_CODE_SUCCESS;
+
+	auto tn = fs::path( path ).filename().u8string();
+	std::string groupName = page ? page->name : std::string( reinterpret_cast<const char*>( tn.data() ), tn.size() );
+
+	// nothing from the previous group is still in use
+	arena_reset( &groupArena );
+
+	ArenaResource resource( &groupArena );
+
+	Group group =
+	{
+		.diffuse = std::pmr::vector<Image>( &resource ),
+		.normal = std::pmr::vector<Image>( &resource ),
+		.emissive = std::pmr::vector<Image>( &resource ),
+		.normalIndex = { .slots = std::pmr::vector<NameIndex::Slot>( &resource ), .count = 0 },
+		.emissiveIndex = { .slots = std::pmr::vector<NameIndex::Slot>( &resource ), .count = 0 },
+		.colliders = std::pmr::vector<GenCollisionData>( &resource ),
+		.meshVertices = std::pmr::vector<vec2>( &resource ),
+	};
+	std::pmr::vector<stbrp_rect> rects( &resource );
+	std::pmr::vector<TexpackSpriteNamed> texpackSprite( &resource );
+
+	ImageFilesData imgData =
+	{
+		.group = group,
+		.rects = rects,
+		.texpackSprite = texpackSprite,
+		.prefix = {},
+		.page = page,
+	};
+
+	constexpr i32 reserveAmount = 1024;
+	group.diffuse.reserve( reserveAmount );
+	group.normal.reserve( reserveAmount );
+	group.emissive.reserve( reserveAmount );
+	rects.reserve( reserveAmount );
+
+	if ( page )
+	{
+		for ( u64 g = 0; g < page->groups.size() && ret == RESULT_CODE_SUCCESS; ++g )
+		{
+			imgData.prefix = page->groups[ g ] + "/";
+			ret = image_files( ( std::string( path ) + "/" + page->groups[ g ] ).c_str(), app, data, &imgData );
+		}
+	}
+	else
+	{
+		// the layers of an array share one .dat, so equal sprite names of different layers are kept apart
+		if ( array )
+			imgData.prefix = groupName + "/";
+
+		ret = image_files( path, app, data, &imgData );
+	}
+
+	if ( ret != RESULT_CODE_SUCCESS )
+		return ret;
+
+	// the atlas of every rect, empty unless routing
+	std::vector<u8> rectAtlas;
+	std::vector<OutputAtlas> atlases;
+
+	// plan mode has no pixels to classify
+	if ( data->routeChannels && !data->plan )
+		route_channels( group, texpackSprite, (u32)rects.size(), rectAtlas, atlases );
+
+	// the previous placements are applied to a copy before the fresh pack moves the rects
+	std::pmr::vector<stbrp_rect> stableRects( &resource );
+	std::vector<u8> stableRotated;
+	bool stablePacked = false;
+
+	if ( data->stable )
+	{
+		std::string layoutName = data->outputName + "/";
+		layoutName += array ? array->name : groupName;
+		layoutName += !data->bundle ? ".dat" : data->tileSize > 0 ? ".tiles" : ".tex";
+
+		std::unordered_map<std::string, PreviousSprite> layout;
+
+		if ( read_previous_layout( layoutName, layer, data, layout ) && !layout.empty() )
+		{
+			u32 keptCount;
+			stableRects.assign( rects.begin(), rects.end() );
+			stablePacked = stable_pack( data, layout, texpackSprite, group.diffuse, stableRects, stableRotated, &keptCount );
+
+			if ( app->verbose )
+				std::println( "Stable layout: kept {} of {} rects from {}", keptCount, rects.size(), layoutName );
+		}
+		else if ( app->verbose )
+		{
+			std::println( "No usable previous layout: {}", layoutName );
+		}
+	}
+
+	std::vector<u8> rotated;
+	std::vector<u8> rectOpacity;
+	bool packed;
+
+	// plan mode has no pixels to classify
+	if ( data->groupOpacity && !data->plan )
+	{
+		rectOpacity.resize( rects.size() );
+
+		for ( const TexpackSpriteNamed &spr : texpackSprite )
+		{
+			if ( spr.sprite.hasFrameUVs )
+			{
+				for ( i32 frame = 0; frame < spr.sprite.frameCount; ++frame )
+					rectOpacity[ spr.firstRect + frame ] = spr.frameOpacity[ frame ];
+			}
+			else
+			{
+				rectOpacity[ spr.firstRect ] = spr.sprite.opacity;
+			}
+		}
+	}
+
+	if ( !rectAtlas.empty() )
+		packed = pack_rects_routed( app, data, rects, rotated, rectOpacity, rectAtlas, atlases );
+	else if ( data->groupOpacity && !data->plan )
+		packed = pack_rects_grouped( app, data, rects, rotated, rectOpacity );
+	else
+		packed = pack_rects( app, data, rects, rotated );
+
+	// the kept layout is used unless its holes cost more of the texture height than the threshold
+	if ( stablePacked )
+	{
+		auto used_height = []( const std::pmr::vector<stbrp_rect> &packedRects )
+		{
+			i32 usedHeight = 0;
+			for ( const stbrp_rect &rect : packedRects )
+				usedHeight = max_value( usedHeight, rect.y + rect.h );
+			return usedHeight;
+		};
+
+		i32 extraRows = packed ? used_height( stableRects ) - used_height( rects ) : 0;
+
+		if ( (i64)extraRows * 100 > (i64)data->stableThreshold * data->textureHeight )
+		{
+			std::println( "Stable layout needs {} more rows than a full repack, repacking. ({})", extraRows, path );
+		}
+		else
+		{
+			rects.assign( stableRects.begin(), stableRects.end() );
+			rotated = std::move( stableRotated );
+			packed = true;
+		}
+	}
+
+	if ( data->plan )
+	{
+		// a failed rotated pack leaves the rects as they were, pack them upright to find the ones that overflow
+		if ( !packed && data->allowRotation )
+		{
+			rotated.assign( rects.size(), false );
+			pack_attempt( rects.data(), (u32)rects.size(), data->textureWidth, data->textureHeight );
+		}
+
+		plan_group( groupName, array, layer, texpackSprite, rects, rotated, packed, app, data );
+		return ret;
+	}
+
+	if ( !packed )
+	{
+		// TODO : in future could possible make another texture for the overflowed ones
+		std::println( stderr, "Failed to pack all images. ({})", path );
+		return RESULT_CODE_FAILED_TO_PACK_ALL;
+	}
+
+	// a layout that is a grid is also described as one, so a reader can index the cells
+	TexpackGrid grid = {};
+
+	if ( !array && atlases.empty() && layout_grid( rects, rotated, group.diffuse, data, &grid ) && app->verbose )
+		std::println( "Grid layout: {} cells of {}x{} in {} columns", grid.count, grid.cellSize.x, grid.cellSize.y, grid.columns );
+
+	f32 tw = (f32)data->textureWidth;
+
+	std::vector<CompositeBlit> blits;
+	blits.reserve( rects.size() );
+
+	for ( u64 i = 0, count = texpackSprite.size(); i < count; ++i )
+	{
+		Image &diffuse = group.diffuse[ i ];
+		Image *normal = nullptr;
+		Image *emissive = nullptr;
+
+		TexpackSpriteNamed *spr = &texpackSprite[ i ];
+
+		if ( u32 index = name_index_find( group.normalIndex, diffuse.filename ); index != UINT32_MAX && group.normal[ index ].img )
+		{
+			normal = &group.normal[ index ];
+		}
+
+		if ( u32 index = name_index_find( group.emissiveIndex, diffuse.filename ); index != UINT32_MAX && group.emissive[ index ].img )
+		{
+			emissive = &group.emissive[ index ];
+		}
+
+		i32 margin = diffuse.margin;
+		i32 padding = diffuse.padding;
+		i32 frameCount = spr->sprite.frameCount;
+		i32 frameW = diffuse.frameW;
+		i32 frameH = diffuse.frameH;
+		i32 inputTextureW = diffuse.width - ( margin * 2 + padding * 2 * frameCount );
+
+		if ( normal && ( ( normal->width / frameCount ) != frameW || normal->height != frameH ) )
+		{
+			std::println( stderr, "Normal texture should be same size as diffuse texture." );
+			return RESULT_CODE_NORMAL_TEXTURE_NOT_SAME_SIZE_AS_DIFFUSE;
+		}
+
+		if ( emissive && ( ( emissive->width / frameCount ) != frameW || emissive->height != frameH ) )
+		{
+			std::println( stderr, "Emissive texture should be same size as diffuse texture." );
+			return RESULT_CODE_EMISSIVE_TEXTURE_NOT_SAME_SIZE_AS_DIFFUSE;
+		}
+
+		spr->frames.resize( frameCount );
+
+		// routed atlases are shorter than the texture
+		f32 th = (f32)( spr->sprite.atlas > 0 ? atlases[ spr->sprite.atlas - 1 ].height : data->textureHeight );
+
+		for ( i32 frame = 0; frame < frameCount; ++frame )
+		{
+			// frames are either their own rect or laid out left to right in one rect
+			u32 rectIdx = spr->firstRect + ( spr->sprite.hasFrameUVs ? frame : 0 );
+			i32 stripOffset = spr->sprite.hasFrameUVs ? 0 : frame * ( frameW + padding * 2 );
+			const stbrp_rect &rect = rects[ rectIdx ];
+			bool isRotated = rotated[ rectIdx ];
+
+			// work in the upright layout, rotated frames are only transposed when blitting
+			i32 frameOffX = rect.x + margin + padding + ( isRotated ? 0 : stripOffset );
+			i32 frameOffY = rect.y + margin + padding + ( isRotated ? stripOffset : 0 );
+
+			blits.push_back( { &diffuse, normal, emissive, (u32)i, frame, frameOffX, frameOffY, frameW, frameH, inputTextureW, isRotated } );
+
+			// rotated uvs cover the transposed frame
+			f32 offX = (f32)( frameOffX - padding );
+			f32 offY = (f32)( frameOffY - padding );
+			f32 uvW = (f32)( ( isRotated ? frameH : frameW ) + padding * 2 );
+			f32 uvH = (f32)( ( isRotated ? frameW : frameH ) + padding * 2 );
+
+			spr->frames[ frame ] = { { offX / tw, offY / th, ( offX + uvW ) / tw, ( offY + uvH ) / th }, isRotated };
+		}
+
+		spr->sprite.uvs = spr->frames[ 0 ].uvs;
+		spr->sprite.isRotated = spr->frames[ 0 ].isRotated;
+		spr->sprite.size = { frameW + padding * 2, frameH + padding * 2 };
+
+		if ( data->tileSize > 0 )
+			sprite_tiles( spr, data );
+	}
+
+	// any layer of any frame being translucent marks the sprite
+	std::vector<u8> blitTranslucent( blits.size() );
+
+	parallel_for( (u32)blits.size(), [ &blits, &blitTranslucent ]( u32 i )
+	{
+		const CompositeBlit &blit = blits[ i ];
+		blitTranslucent[ i ] = image_frame_translucent( blit.diffuse, blit.frame, blit.frameW, blit.frameH, blit.inputW )
+			|| ( blit.normal && image_frame_translucent( blit.normal, blit.frame, blit.frameW, blit.frameH, blit.inputW ) )
+			|| ( blit.emissive && image_frame_translucent( blit.emissive, blit.frame, blit.frameW, blit.frameH, blit.inputW ) );
+	} );
+
+	for ( u64 i = 0, count = blits.size(); i < count; ++i )
+	{
+		if ( blitTranslucent[ i ] )
+			texpackSprite[ blits[ i ].sprite ].sprite.isTranslucent = true;
+	}
+
+	if ( app->verbose )
+		std::println( "Compositing {} frames. {}", blits.size(), path );
+
+	u64 totalBytes = (u64)data->textureWidth * data->textureHeight * data->outputChannels;
+
+	std::vector<u8> diffuseImage( totalBytes );
+	std::vector<u8> normalImage( totalBytes );
+	std::vector<u8> emissiveImage( totalBytes );
+
+	if ( !atlases.empty() )
+	{
+		for ( OutputAtlas &atlas : atlases )
+			atlas.pixels.assign( (u64)atlas.width * atlas.height * atlas.channels, 0 );
+
+		render_routed( atlases, blits, texpackSprite );
+
+		std::erase_if( blits, [ &texpackSprite ]( const CompositeBlit &blit ) { return texpackSprite[ blit.sprite ].sprite.atlas > 0; } );
+	}
+
+	composite_bands( diffuseImage, normalImage, emissiveImage, blits, data );
+
+	// the routed blits are gone by now, they have nothing to fill: RGB8 and gray sprites are opaque and
+	// never padded, alpha only sprites keep no colour and are drawn white
+	if ( data->dilate )
+	{
+		if ( app->verbose )
+			std::println( "Dilating {} frames. {}", blits.size(), path );
+
+		dilate_frames( diffuseImage, normalImage, emissiveImage, blits, data );
+	}
+
+	for ( Image &image : group.diffuse )
+	{
+		stbi_image_free( image.img );
+		image.img = nullptr;
+	}
+
+	for ( Image &image : group.normal )
+	{
+		stbi_image_free( image.img );
+		image.img = nullptr;
+	}
+
+	for ( Image &image : group.emissive )
+	{
+		stbi_image_free( image.img );
+		image.img = nullptr;
+	}
+
+	if ( data->premultiply )
+	{
+		if ( app->verbose )
+			std::println( "Premultiplying alpha. {}", path );
+
+		premultiply_alpha( diffuseImage, data->textureWidth, data->textureHeight );
+	}
+
+	for ( u64 i = 0, count = texpackSprite.size(); i < count; ++i )
+		texpackSprite[ i ].sprite.layer = layer;
+
+	Output groupOutput = {};
+	Output *output = array ? array : &groupOutput;
+
+	if ( !array )
+	{
+		groupOutput.name = groupName;
+		groupOutput.diffuse.resize( 1 );
+		groupOutput.normal.resize( 1 );
+		groupOutput.emissive.resize( 1 );
+	}
+
+	output->diffuse[ layer ] = std::move( diffuseImage );
+	output->normal[ layer ] = std::move( normalImage );
+	output->emissive[ layer ] = std::move( emissiveImage );
+	output->atlases = std::move( atlases );
+	output->grid = grid;
+
+	// the pools of an array hold every layer, so the offsets move past the layers before
+	for ( u64 i = 0, count = texpackSprite.size(); i < count; ++i )
+	{
+		texpackSprite[ i ].firstCollider += (u32)output->colliders.size();
+		texpackSprite[ i ].firstMeshVertex += (u32)output->meshVertices.size();
+		output->sprites.push_back( std::move( texpackSprite[ i ] ) );
+	}
+
+	output->colliders.insert( output->colliders.end(), std::make_move_iterator( group.colliders.begin() ), std::make_move_iterator( group.colliders.end() ) );
+	output->meshVertices.insert( output->meshVertices.end(), group.meshVertices.begin(), group.meshVertices.end() );
+
+	if ( array )
+		return ret;
+
+	return write_output( &groupOutput, app, data );
+}
+
+static void write_dat( std::ostream &out, const std::string &textureFile, const Output *output, Data *data )
+{
+	TexpackHeader texpackHeader =
+	{
+		.magicNumber = 'PxeT',
+		.majorVersion = VERSION_MAJOR,
+		.minorVersion = VERSION_MINOR,
+		.revisionVersion = VERSION_REVISION,
+		.reserved = 0,
+	};
+
+	TexpackTexture texpackTexture;
+	texpackTexture.size = { data->textureWidth, data->textureHeight };
+	texpackTexture.numSprites = (u32)output->sprites.size();
+	texpackTexture.atlasCount = (u8)( 1 + output->atlases.size() );
+	texpackTexture.hasGrid = output->grid.count > 0;
+
+	out.write( (char*)&texpackHeader, sizeof( texpackHeader ) );
+
+	out.write( textureFile.c_str(), textureFile.length() + 1 ); // +1 to write the null terminator
+	out.write( (char*)&texpackTexture, sizeof( texpackTexture ) );
+
+	// the routed atlases are named like the texture with their suffix before the extension
+	u64 dot = textureFile.rfind( '.' );
+
+	for ( const OutputAtlas &atlas : output->atlases )
+	{
+		std::string atlasFile = textureFile.substr( 0, dot ) + atlas.suffix + textureFile.substr( dot );
+		TexpackAtlas texpackAtlas = { { atlas.width, atlas.height }, atlas.pixelFormat };
+
+		out.write( atlasFile.c_str(), atlasFile.length() + 1 ); // +1 to write the null terminator
+		out.write( (char*)&texpackAtlas, sizeof( texpackAtlas ) );
+	}
+
+	if ( texpackTexture.hasGrid )
+		out.write( (char*)&output->grid, sizeof( output->grid ) );
+
+	for ( u64 i = 0, count = output->sprites.size(); i < count; ++i )
+	{
+		const TexpackSpriteNamed *spr = &output->sprites[ i ];
+
+		out.write( spr->name.c_str(), spr->name.length() + 1 ); // +1 to write the null terminator
+		out.write( (char*)&spr->sprite, sizeof( TexpackSprite ) );
+
+		if ( spr->sprite.hasFrameUVs )
+			out.write( (char*)spr->frames.data(), spr->frames.size() * sizeof( TexpackFrame ) );
+
+		if ( spr->sprite.frameCount > 1 )
+			out.write( (char*)spr->frameOpacity.data(), spr->frameOpacity.size() );
+
+		if ( spr->sprite.tileCount > 0 )
+			out.write( (char*)spr->tiles.data(), spr->tiles.size() * sizeof( u32 ) );
+
+		for ( i32 colIdx = 0, colCount = spr->sprite.colliderCount; colIdx < colCount; ++colIdx )
+		{
+			const GenCollisionData *col = &output->colliders[ spr->firstCollider + colIdx ];
+
+			switch ( col->type )
+			{
+			case GEN_COLLISION_DATA_TYPE_RECT_AUTO:
+			case GEN_COLLISION_DATA_TYPE_RECT_FULL:
+			case GEN_COLLISION_DATA_TYPE_RECT_MANUAL:
+				{
+					u8 colliderType = COLLIDER_TYPE_RECT;
+					out.write( (char*)&colliderType, sizeof( colliderType ) );
+					out.write( (char*)&col->area, sizeof( col->area ) );
+				}
+				break;
+
+			case GEN_COLLISION_DATA_TYPE_CIRCLE_AUTO:
+			case GEN_COLLISION_DATA_TYPE_CIRCLE_AUTO_ENCOMPASS:
+			case GEN_COLLISION_DATA_TYPE_CIRCLE_MANUAL:
+				{
+					u8 colliderType = COLLIDER_TYPE_CIRCLE;
+					out.write( (char*)&colliderType, sizeof( colliderType ) );
+					out.write( (char*)&col->position, sizeof( col->position ) );
+					out.write( (char*)&col->radius, sizeof( col->radius ) );
+				}
+				break;
+
+			case GEN_COLLISION_DATA_TYPE_MASK:
+				{
+					u8 colliderType = COLLIDER_TYPE_MASK;
+					out.write( (char*)&colliderType, sizeof( colliderType ) );
+					out.write( (char*)&col->maskSize, sizeof( col->maskSize ) );
+					out.write( (char*)col->mask.data(), col->mask.size() * sizeof( u64 ) );
+				}
+				break;
+			}
+		}
+
+		if ( spr->sprite.meshVertexCount > 0 )
+		{
+			out.write( (char*)&output->meshVertices[ spr->firstMeshVertex ], spr->sprite.meshVertexCount * sizeof( vec2 ) );
+
+			// triangle fan, the outline is convex
+			for ( u16 v = 1, vertexCount = spr->sprite.meshVertexCount; v + 1 < vertexCount; ++v )
+			{
+				u16 triangle[ 3 ] = { 0, v, (u16)( v + 1 ) };
+				out.write( (char*)triangle, sizeof( triangle ) );
+			}
+		}
+	}
+}
+
+static RESULT_CODE write_output( Output *output, App *app, Data *data )
+{
+	std::string outputName;
+	outputName.reserve( 4096 );
+
+	outputName += data->outputName;
+	outputName += "/";
+	outputName += output->name;
+
+	// arrays need a container, png has no layers
+	bool isContainer = output->isArray || data->outputFormat == OUTPUT_FORMAT_CONTAINER;
+	bool isTiled = data->tileSize > 0;
+
+	std::string extension = isTiled ? ".tiles" : isContainer ? ".tex" : ".png";
+	std::string diffuseName = outputName + extension;
+	std::string normalName = outputName + "_n" + extension;
+	std::string emissiveName = outputName + "_e" + extension;
+
+	std::ostringstream datBuffer( std::ios::binary );
+	write_dat( datBuffer, output->name + extension, output, data );
+	std::string datBytes = datBuffer.str();
+
+	if ( data->writeHeader )
+	{
+		std::string headerName = outputName + ".h";
+
+		if ( app->verbose )
+			std::println( "Writing header: {}", headerName );
+
+		if ( !write_cpp_header( headerName, output->name, output->name + extension, output, app, data ) )
+		{
+			std::println( stderr, "Failed to create header file: {}", headerName );
+			return RESULT_CODE_FAILED_TO_CREATE_HEADER_FILE;
+		}
+
+		app->outputFiles.push_back( headerName );
+	}
+
+	for ( const OutputAtlas &atlas : output->atlases )
+	{
+		std::string atlasName = outputName + atlas.suffix + extension;
+
+		std::println( "Saving texture: {}", atlasName );
+
+		bool written;
+
+		if ( isContainer )
+		{
+			ContainerLayer layer = { atlas.pixels.data(), atlas.width, atlas.height, atlas.channels };
+			written = write_texture_container( atlasName, &layer, 1, nullptr, app, data );
+		}
+		else
+		{
+			written = stbi_write_png( atlasName.c_str(), atlas.width, atlas.height, atlas.channels, atlas.pixels.data(), atlas.width * atlas.channels ) != 0;
+		}
+
+		if ( !written )
+		{
+			std::println( stderr, "Failed to create texture file: {}", atlasName );
+			return RESULT_CODE_FAILED_TO_CREATE_TEXTURE_FILE;
+		}
+
+		app->outputFiles.push_back( atlasName );
+	}
+
+	std::println( "Saving texture: {}", diffuseName );
+
+	u16 layerCount = (u16)output->diffuse.size();
+
+	std::vector<ContainerLayer> layers;
+	layers.reserve( layerCount * 3 );
+
+	for ( const std::vector<std::vector<u8>> *images : { &output->diffuse, &output->normal, &output->emissive } )
+		for ( const std::vector<u8> &image : *images )
+			layers.push_back( { image.data(), data->textureWidth, data->textureHeight, data->outputChannels } );
+
+	// a bundle carries the .dat inside the texture
+	if ( data->bundle )
+	{
+		auto write = isTiled ? write_tile_pack : write_texture_container;
+
+		if ( !write( diffuseName, layers.data(), (u16)layers.size(), &datBytes, app, data ) )
+		{
+			std::println( stderr, "Failed to create texture file: {}", diffuseName );
+			return RESULT_CODE_FAILED_TO_CREATE_TEXTURE_FILE;
+		}
+
+		app->outputFiles.push_back( diffuseName );
+		return RESULT_CODE_SUCCESS;
+	}
+
+	std::ofstream dataFile( outputName + ".dat", std::ios::binary );
+	if ( !dataFile.good() )
+	{
+		std::println( stderr, "Failed to create data file: {}.dat", outputName );
+		return RESULT_CODE_FAILED_TO_CREATE_DATA_FILE;
+	}
+
+	dataFile.write( datBytes.data(), datBytes.size() );
+	dataFile.close();
+	app->outputFiles.push_back( outputName + ".dat" );
+
+	// one tile pack holds every layer
+	if ( isTiled )
+	{
+		if ( !write_tile_pack( diffuseName, layers.data(), (u16)layers.size(), nullptr, app, data ) )
+		{
+			std::println( stderr, "Failed to create texture file: {}", diffuseName );
+			return RESULT_CODE_FAILED_TO_CREATE_TEXTURE_FILE;
+		}
+
+		app->outputFiles.push_back( diffuseName );
+		return RESULT_CODE_SUCCESS;
+	}
+
+	const std::string *names[] = { &diffuseName, &normalName, &emissiveName };
+
+	for ( u32 kind = 0; kind < 3; ++kind )
+	{
+		const ContainerLayer *layer = &layers[ kind * layerCount ];
+
+		if ( isContainer )
+		{
+			if ( !write_texture_container( *names[ kind ], layer, layerCount, nullptr, app, data ) )
+			{
+				std::println( stderr, "Failed to create texture file: {}", *names[ kind ] );
+				return RESULT_CODE_FAILED_TO_CREATE_TEXTURE_FILE;
+			}
+		}
+		else
+		{
+			stbi_write_png( names[ kind ]->c_str(), data->textureWidth, data->textureHeight, data->outputChannels, layer->pixels, data->textureWidth * data->outputChannels );
+		}
+
+		app->outputFiles.push_back( *names[ kind ] );
+	}
+
+	return RESULT_CODE_SUCCESS;
+}
+
+// Pixels of every png under the group, only the headers are read.
+static u64 group_pixel_count( const fs::path &path )
+{
+	u64 pixels = 0;
+
+	for ( const fs::directory_entry &entry : sorted_entries( path, true ) )
+	{
+		if ( entry.is_directory() || entry.path().extension() == ".txt" )
+			continue;
+
+		auto fp = entry.path().u8string();
+		std::string filepath( reinterpret_cast<const char*>( fp.data() ), fp.size() );
+		i32 width, height, channels;
+
+		if ( stbi_info( filepath.c_str(), &width, &height, &channels ) )
+			pixels += (u64)width * height;
+	}
+
+	return pixels;
+}
+
+// Splits the top level groups between the shards by input pixels, largest first onto the lightest shard.
+// The groups of a texture array stay together. Every shard computes the same split from the same inputs,
+// so the processes never need to talk to each other.
+static void shard_groups( const char *inputPath, Data *data, std::unordered_set<std::string> &groups, std::vector<u8> &arrays )
+{
+	struct ShardUnit
+	{
+		std::vector<std::string> groups;
+		i64 array;
+		u64 pixels;
+	};
+
+	std::vector<ShardUnit> units;
+	std::vector<u64> arrayUnits( data->arrays.size() );
+
+	for ( u64 a = 0; a < data->arrays.size(); ++a )
+	{
+		arrayUnits[ a ] = units.size();
+		units.push_back( { {}, (i64)a, 0 } );
+	}
 
-					case GEN_COLLISION_DATA_TYPE_RECT_FULL:
-						colData->area = { padding, padding, image->frameW, image->frameH };
-						break;
+	for ( const fs::directory_entry &entry : sorted_entries( inputPath, false ) )
+	{
+		if ( !entry.is_directory() )
+			continue;
+
+		auto fn = entry.path().filename().u8string();
+		std::string name( reinterpret_cast<const char*>( fn.data() ), fn.size() );
+
+		ShardUnit *unit = nullptr;
+
+		for ( u64 a = 0; a < data->arrays.size() && !unit; ++a )
+		{
+			if ( std::find( data->arrays[ a ].groups.begin(), data->arrays[ a ].groups.end(), name ) != data->arrays[ a ].groups.end() )
+				unit = &units[ arrayUnits[ a ] ];
+		}
+
+		if ( !unit )
+			unit = &units.emplace_back( ShardUnit{ {}, -1, 0 } );
+
+		unit->pixels += group_pixel_count( entry.path() );
+		unit->groups.push_back( std::move( name ) );
+	}
+
+	// equal weights keep the listing order, so the split only depends on the inputs
+	std::stable_sort( units.begin(), units.end(), []( const ShardUnit &l, const ShardUnit &r ) { return l.pixels > r.pixels; } );
+
+	std::vector<u64> load( data->shardCount, 0 );
+	u64 ownPixels = 0;
+
+	arrays.assign( data->arrays.size(), 0 );
+
+	for ( ShardUnit &unit : units )
+	{
+		u32 shard = (u32)( std::min_element( load.begin(), load.end() ) - load.begin() );
+		load[ shard ] += unit.pixels;
+
+		if ( shard != data->shardIndex - 1 )
+			continue;
+
+		ownPixels += unit.pixels;
+
+		for ( std::string &group : unit.groups )
+			groups.insert( std::move( group ) );
+
+		if ( unit.array >= 0 )
+			arrays[ unit.array ] = 1;
+	}
+
+	std::println( "Shard {}/{}: {} groups, {} input pixels", data->shardIndex, data->shardCount, groups.size(), ownPixels );
+}
+
+static std::string shard_manifest_name( u32 index, u32 count )
+{
+	return std::format( "shard-{}-of-{}.json", index, count );
+}
+
+// Lists the files this shard wrote with their size and hash, so the merge can check nothing was
+// lost or overwritten by another shard.
+static bool write_shard_manifest( const std::vector<std::string> &groups, App *app, Data *data )
+{
+	std::string out = std::format( "{{\n\t\"version\": \"{}.{}.{}\",\n\t\"shard\": {},\n\t\"shards\": {},\n\t\"options\": {},\n\t\"groups\":\n\t[\n",
+		VERSION_MAJOR, VERSION_MINOR, VERSION_REVISION, data->shardIndex, data->shardCount, json_string( app->options ) );
+
+	for ( u64 i = 0; i < groups.size(); ++i )
+		out += std::format( "\t\t{}{}\n", json_string( groups[ i ] ), i + 1 < groups.size() ? "," : "" );
+
+	out += "\t],\n\t\"files\":\n\t[\n";
+
+	std::vector<u8> bytes;
+
+	for ( u64 i = 0; i < app->outputFiles.size(); ++i )
+	{
+		const std::string &file = app->outputFiles[ i ];
+
+		if ( !read_file( file, bytes ) )
+		{
+			std::println( stderr, "Failed to read output: {}", file );
+			return false;
+		}
+
+		auto fn = fs::path( file ).filename().u8string();
+
+		out += std::format( "\t\t{{ \"name\": {}, \"size\": {}, \"hash\": \"{:016x}\" }}{}\n",
+			json_string( std::string_view( reinterpret_cast<const char*>( fn.data() ), fn.size() ) ), bytes.size(),
+			hash_bytes( bytes.data(), bytes.size() ), i + 1 < app->outputFiles.size() ? "," : "" );
+	}
+
+	out += "\t]\n}\n";
+
+	std::string manifestName = data->outputName + "/" + shard_manifest_name( data->shardIndex, data->shardCount );
+	std::ofstream manifest( manifestName, std::ios::binary );
+	manifest.write( out.data(), out.size() );
+
+	if ( !manifest.good() )
+	{
+		std::println( stderr, "Failed to write manifest: {}", manifestName );
+		return false;
+	}
+
+	std::println( "Saving manifest: {}", manifestName );
+	return true;
+}
+
+struct ShardFile
+{
+	std::string name;
+	u64 size;
+	std::string hash;
+};
+
+struct ShardManifest
+{
+	std::string version;
+	u32 shard;
+	u32 shards;
+	std::string options;
+	std::vector<std::string> groups;
+	std::vector<ShardFile> files;
+};
+
+// Reads back what write_shard_manifest wrote. Keys and strings are taken in order, no general json.
+static bool read_shard_manifest( const std::string &filename, ShardManifest *manifest )
+{
+	std::vector<u8> bytes;
+	if ( !read_file( filename, bytes ) )
+		return false;
+
+	std::string_view text( (const char*)bytes.data(), bytes.size() );
+	std::string key;
+	std::string value;
+	std::string list;
+	u64 pos = 0;
+
+	auto read_string = [ &text, &pos ]( std::string &out )
+	{
+		out.clear();
+
+		for ( ++pos; pos < text.size() && text[ pos ] != '"'; ++pos )
+		{
+			if ( text[ pos ] != '\\' )
+			{
+				out += text[ pos ];
+			}
+			else if ( pos + 1 < text.size() && text[ pos + 1 ] == 'u' && pos + 5 < text.size() )
+			{
+				u32 code = 0;
+				std::from_chars( &text[ pos + 2 ], &text[ pos + 6 ], code, 16 );
+				out += (char)code;
+				pos += 5;
+			}
+			else if ( pos + 1 < text.size() )
+			{
+				out += text[ ++pos ];
+			}
+		}
+
+		++pos;
+		return pos <= text.size();
+	};
+
+	while ( pos < text.size() )
+	{
+		char c = text[ pos ];
+
+		if ( c == '"' )
+		{
+			if ( !read_string( value ) )
+				return false;
+
+			while ( pos < text.size() && text[ pos ] == ' ' )
+				++pos;
+
+			if ( pos < text.size() && text[ pos ] == ':' )
+			{
+				key = value;
+				++pos;
+				continue;
+			}
+
+			if ( list == "groups" )
+				manifest->groups.push_back( value );
+			else if ( key == "version" )
+				manifest->version = value;
+			else if ( key == "options" )
+				manifest->options = value;
+			else if ( key == "name" && !manifest->files.empty() )
+				manifest->files.back().name = value;
+			else if ( key == "hash" && !manifest->files.empty() )
+				manifest->files.back().hash = value;
+		}
+		else if ( c >= '0' && c <= '9' )
+		{
+			u64 number = 0;
+			auto [ ptr, ec ] = std::from_chars( text.data() + pos, text.data() + text.size(), number );
+			pos = ptr - text.data();
+
+			if ( key == "shard" )
+				manifest->shard = (u32)number;
+			else if ( key == "shards" )
+				manifest->shards = (u32)number;
+			else if ( key == "size" && !manifest->files.empty() )
+				manifest->files.back().size = number;
+		}
+		else
+		{
+			if ( c == '[' )
+				list = key;
+			else if ( c == ']' )
+				list.clear();
+			else if ( c == '{' && list == "files" )
+				manifest->files.emplace_back();
+
+			++pos;
+		}
+	}
+
+	return manifest->shards > 0 && manifest->shard >= 1 && manifest->shard <= manifest->shards;
+}
+
+// Checks the shard manifests in the output folder belong to one build: every shard present once, the same
+// version and options, no group or file claimed twice and every file as its shard wrote it. Then writes
+// manifest.json for the whole build and removes the shard manifests.
+static RESULT_CODE merge_shards( const std::string &outputName )
+{
+	std::vector<ShardManifest> manifests;
+
+	std::error_code ec;
+	for ( const fs::directory_entry &entry : fs::directory_iterator( outputName, ec ) )
+	{
+		auto fn = entry.path().filename().u8string();
+		std::string filename( reinterpret_cast<const char*>( fn.data() ), fn.size() );
+
+		if ( !filename.starts_with( "shard-" ) || entry.path().extension() != ".json" )
+			continue;
+
+		ShardManifest &manifest = manifests.emplace_back();
+
+		auto fp = entry.path().u8string();
+		std::string filepath( reinterpret_cast<const char*>( fp.data() ), fp.size() );
+
+		if ( !read_shard_manifest( filepath, &manifest ) || filename != shard_manifest_name( manifest.shard, manifest.shards ) )
+		{
+			std::println( stderr, "Invalid shard manifest: {}", filepath );
+			return RESULT_CODE_FAILED_TO_MERGE;
+		}
+	}
+
+	if ( ec || manifests.empty() )
+	{
+		std::println( stderr, "No shard manifests found in: {}", outputName );
+		return RESULT_CODE_FAILED_TO_MERGE;
+	}
+
+	std::sort( manifests.begin(), manifests.end(), []( const ShardManifest &l, const ShardManifest &r ) { return l.shard < r.shard; } );
+
+	u32 shards = manifests[ 0 ].shards;
+	std::string version = std::format( "{}.{}.{}", VERSION_MAJOR, VERSION_MINOR, VERSION_REVISION );
+	bool valid = true;
+
+	for ( u32 s = 1; s <= shards; ++s )
+	{
+		auto found = std::find_if( manifests.begin(), manifests.end(), [ s, shards ]( const ShardManifest &m ) { return m.shard == s && m.shards == shards; } );
+
+		if ( found == manifests.end() )
+		{
+			std::println( stderr, "Missing shard manifest: {}", shard_manifest_name( s, shards ) );
+			valid = false;
+		}
+	}
+
+	std::map<std::string, u32> groups;
+	std::map<std::string, const ShardFile*> files;
+	std::vector<u8> bytes;
+
+	for ( const ShardManifest &manifest : manifests )
+	{
+		if ( manifest.shards != shards )
+		{
+			std::println( stderr, "{} is from a build of {} shards, not {}", shard_manifest_name( manifest.shard, manifest.shards ), manifest.shards, shards );
+			valid = false;
+		}
+
+		if ( manifest.version != version )
+		{
+			std::println( stderr, "{} was written by version {}, not {}", shard_manifest_name( manifest.shard, manifest.shards ), manifest.version, version );
+			valid = false;
+		}
+
+		if ( manifest.options != manifests[ 0 ].options )
+		{
+			std::println( stderr, "{} was built with different options: {}", shard_manifest_name( manifest.shard, manifest.shards ), manifest.options );
+			valid = false;
+		}
+
+		for ( const std::string &group : manifest.groups )
+		{
+			if ( !groups.emplace( group, manifest.shard ).second )
+			{
+				std::println( stderr, "Group {} was built by shards {} and {}", group, groups[ group ], manifest.shard );
+				valid = false;
+			}
+		}
+
+		for ( const ShardFile &file : manifest.files )
+		{
+			if ( !files.emplace( file.name, &file ).second )
+			{
+				std::println( stderr, "File {} was written by more than one shard", file.name );
+				valid = false;
+				continue;
+			}
+
+			std::string filename = outputName + "/" + file.name;
+
+			if ( !read_file( filename, bytes ) || bytes.size() != file.size || std::format( "{:016x}", hash_bytes( bytes.data(), bytes.size() ) ) != file.hash )
+			{
+				std::println( stderr, "File {} is missing or changed since shard {} wrote it", filename, manifest.shard );
+				valid = false;
+			}
+		}
+	}
+
+	if ( !valid )
+		return RESULT_CODE_FAILED_TO_MERGE;
+
+	// sorted by name, the same build split any number of ways merges to the same manifest
+	std::string out = std::format( "{{\n\t\"version\": {},\n\t\"options\": {},\n\t\"groups\":\n\t[\n", json_string( version ), json_string( manifests[ 0 ].options ) );
+
+	u64 index = 0;
+	for ( const auto &[ group, shard ] : groups )
+		out += std::format( "\t\t{}{}\n", json_string( group ), ++index < groups.size() ? "," : "" );
+
+	out += "\t],\n\t\"files\":\n\t[\n";
+
+	index = 0;
+	for ( const auto &[ name, file ] : files )
+		out += std::format( "\t\t{{ \"name\": {}, \"size\": {}, \"hash\": \"{}\" }}{}\n", json_string( name ), file->size, file->hash, ++index < files.size() ? "," : "" );
+
+	out += "\t]\n}\n";
+
+	std::string manifestName = outputName + "/manifest.json";
+	std::ofstream manifest( manifestName, std::ios::binary );
+	manifest.write( out.data(), out.size() );
+
+	if ( !manifest.good() )
+	{
+		std::println( stderr, "Failed to write manifest: {}", manifestName );
+		return RESULT_CODE_FAILED_TO_MERGE;
+	}
+
+	manifest.close();
+
+	for ( const ShardManifest &m : manifests )
+		fs::remove( outputName + "/" + shard_manifest_name( m.shard, m.shards ), ec );
+
+	std::println( "Merged {} shards, {} groups, {} files: {}", shards, groups.size(), files.size(), manifestName );
+	return RESULT_CODE_SUCCESS;
+}
+
+// One Data per PROFILE of the file, each starting from the command line options and
+// writing into its own folder of the output folder. See README.md for the fields.
+static bool read_profiles( const std::string &filename, const Data &base, std::vector<Data> &profiles )
+{
+	std::ifstream file( filename, std::ios::binary );
+	if ( !file.good() )
+	{
+		std::println( stderr, "Failed to open profiles: {}", filename );
+		return false;
+	}
+
+	std::string field;
+	std::string value;
+
+	while ( file >> field )
+	{
+		if ( field == "PROFILE" )
+		{
+			Data &profile = profiles.emplace_back( base );
+			file >> profile.profileName;
+
+			bool duplicate = std::count_if( profiles.begin(), profiles.end(), [ &profile ]( const Data &other ) { return other.profileName == profile.profileName; } ) > 1;
+
+			if ( profile.profileName.empty() || profile.profileName.find_first_of( "/\\." ) != std::string::npos || duplicate )
+			{
+				std::println( stderr, "Invalid or repeated profile name: {}", profile.profileName );
+				return false;
+			}
+
+			profile.outputName = base.outputName + "/" + profile.profileName;
+			continue;
+		}
+
+		if ( profiles.empty() )
+		{
+			std::println( stderr, "Profile field before the first PROFILE: {}", field );
+			return false;
+		}
+
+		Data &profile = profiles.back();
+		bool valid = true;
+
+		if ( field == "SIZE" )
+		{
+			valid = ( file >> profile.textureWidth >> profile.textureHeight ) && profile.textureWidth > 0 && profile.textureHeight > 0;
+		}
+		else if ( field == "SCALE" )
+		{
+			valid = ( file >> profile.scale ) && profile.scale >= 1 && profile.scale <= 16;
+		}
+		else if ( field == "MG" )
+		{
+			valid = ( file >> profile.margin ) && profile.margin >= 0;
+		}
+		else if ( field == "PD" )
+		{
+			valid = ( file >> profile.padding ) && profile.padding >= 0;
+		}
+		else if ( field == "FORMAT" )
+		{
+			file >> value;
+			if ( value == "png" )
+				profile.outputFormat = OUTPUT_FORMAT_PNG;
+			else if ( value == "tex" )
+				profile.outputFormat = OUTPUT_FORMAT_CONTAINER;
+			else
+				valid = false;
+		}
+		else if ( field == "CODEC" )
+		{
+			file >> value;
+			if ( value == "none" )
+				profile.codec = TEXTURE_CODEC_NONE;
+			else if ( value == "lz4" )
+				profile.codec = TEXTURE_CODEC_LZ4;
+			else if ( value == "qoi" )
+				profile.codec = TEXTURE_CODEC_QOI;
+			else
+				valid = false;
+		}
+		else if ( field == "PIXEL" )
+		{
+			file >> value;
+			if ( value == "rgba8" )
+			{
+				profile.pixelFormat = PIXEL_FORMAT_RGBA8;
+			}
+			else if ( value == "rgba4444" )
+			{
+				profile.pixelFormat = PIXEL_FORMAT_RGBA4444;
+			}
+			else
+			{
+				// block compressed formats need an encoder texpack does not have
+				std::println( stderr, "Unsupported pixel format: {} (rgba8 or rgba4444, compress rgba8 with the platform tools for block formats)", value );
+				return false;
+			}
+		}
+		else
+		{
+			std::println( stderr, "Unknown profile field: {}", field );
+			return false;
+		}
+
+		if ( !valid )
+		{
+			std::println( stderr, "Invalid {} in profile {}", field, profile.profileName );
+			return false;
+		}
+	}
+
+	if ( profiles.empty() )
+	{
+		std::println( stderr, "No PROFILE in: {}", filename );
+		return false;
+	}
+
+	return true;
+}
+
+struct UsageScene
+{
+	std::string name;
+	std::vector<std::string> sprites;	// group/sprite
+};
+
+// SCENE <name> followed by the group/sprite names the scene draws, see README.md.
+static bool read_usage( const std::string &filename, std::vector<UsageScene> &scenes, std::vector<std::string> &groups )
+{
+	std::ifstream file( filename, std::ios::binary );
+	if ( !file.good() )
+	{
+		std::println( stderr, "Failed to open usage: {}", filename );
+		return false;
+	}
+
+	std::string field;
+
+	while ( file >> field )
+	{
+		if ( field == "SCENE" )
+		{
+			UsageScene &scene = scenes.emplace_back();
+			if ( !( file >> scene.name ) )
+			{
+				std::println( stderr, "SCENE without a name in: {}", filename );
+				return false;
+			}
+			continue;
+		}
+
+		size_t slash = field.find( '/' );
+
+		if ( scenes.empty() || slash == 0 || slash == std::string::npos || slash == field.size() - 1 )
+		{
+			std::println( stderr, "Expected SCENE or group/sprite in usage: {}", field );
+			return false;
+		}
+
+		groups.push_back( field.substr( 0, slash ) );
+		scenes.back().sprites.push_back( std::move( field ) );
+	}
+
+	std::sort( groups.begin(), groups.end() );
+	groups.erase( std::unique( groups.begin(), groups.end() ), groups.end() );
+
+	return true;
+}
+
+struct UsageSprite
+{
+	std::string name;					// group/sprite
+	u32 group;
+	u64 area;							// of its rects
+	std::vector<ivec2> rects;
+	std::vector<u32> scenes;			// sorted
+};
+
+// Puts the sprites on pages of at most capacity rect area. Sprites drawn by exactly the same scenes move
+// as one, the ones drawn by the most scenes first. Each goes on the page already holding the most of its
+// scenes, then on the fullest page it fits, and only opens a page when it fits on none.
+static u32 partition_usage( const std::vector<UsageSprite> &sprites, u32 sceneCount, u64 capacity, std::vector<u32> &spritePage )
+{
+	struct Unit
+	{
+		const std::vector<u32> *scenes;
+		std::vector<u32> sprites;
+		u64 area;
+	};
+
+	std::map<std::vector<u32>, u32> unitOf;
+	std::vector<Unit> units;
+
+	for ( u32 i = 0; i < sprites.size(); ++i )
+	{
+		auto [ found, added ] = unitOf.try_emplace( sprites[ i ].scenes, (u32)units.size() );
+		if ( added )
+			units.push_back( { &sprites[ i ].scenes, {}, 0 } );
+
+		units[ found->second ].sprites.push_back( i );
+		units[ found->second ].area += sprites[ i ].area;
+	}
+
+	// a unit bigger than a page is placed a sprite at a time
+	for ( u64 u = 0, count = units.size(); u < count; ++u )
+	{
+		if ( units[ u ].area <= capacity || units[ u ].sprites.size() == 1 )
+			continue;
+
+		for ( u64 s = 1; s < units[ u ].sprites.size(); ++s )
+		{
+			u32 sprite = units[ u ].sprites[ s ];
+			units.push_back( { units[ u ].scenes, { sprite }, sprites[ sprite ].area } );
+		}
+
+		units[ u ].sprites.resize( 1 );
+		units[ u ].area = sprites[ units[ u ].sprites[ 0 ] ].area;
+	}
+
+	std::stable_sort( units.begin(), units.end(), []( const Unit &l, const Unit &r )
+	{
+		return l.scenes->size() != r.scenes->size() ? l.scenes->size() > r.scenes->size() : l.area > r.area;
+	} );
 
-					case GEN_COLLISION_DATA_TYPE_RECT_MANUAL:
-						break;
+	struct Page
+	{
+		u64 used;
+		std::vector<u8> hasScene;
+	};
 
-					case GEN_COLLISION_DATA_TYPE_CIRCLE_AUTO:
-						colData->area = image_rect_area( image, spr, imgWidth, data );
-						colData->position = { ( image->frameW + padding * 2 ) / 2, ( image->frameH + padding * 2 ) / 2 };
-						colData->radius = max_value( ( colData->area.z - colData->area.x ), ( colData->area.w - colData->area.y ) );
-						break;
+	std::vector<Page> pages;
+	spritePage.assign( sprites.size(), 0 );
 
-					case GEN_COLLISION_DATA_TYPE_CIRCLE_AUTO_ENCOMPASS:
-						{
-							colData->area = image_rect_area( image, spr, imgWidth, data );
-							colData->position = { ( image->frameW + padding * 2 ) / 2, ( image->frameH + padding * 2 ) / 2 };
-							f32 x = (f32)max_value( abs( colData->area.x ), colData->area.z );
-							f32 y = (f32)max_value( abs( colData->area.y ), colData->area.w );
-							colData->radius = (i32)sqrtf( x * x + y * y );
-						}
-						break;
+	for ( const Unit &unit : units )
+	{
+		u32 best = UINT32_MAX;
+		u64 bestCost = 0;
 
-					case GEN_COLLISION_DATA_TYPE_CIRCLE_MANUAL:
-						break;
-					}
+		for ( u32 p = 0; p < pages.size(); ++p )
+		{
+			if ( pages[ p ].used + unit.area > capacity )
+				continue;
 
-					image->genColData[ colIdx ] = genColData[ colIdx ];
-				}
+			u64 cost = 0;
+			for ( u32 scene : *unit.scenes )
+				cost += !pages[ p ].hasScene[ scene ];
+
+			if ( best == UINT32_MAX || cost < bestCost || ( cost == bestCost && pages[ p ].used > pages[ best ].used ) )
+			{
+				best = p;
+				bestCost = cost;
 			}
 		}
 
-		if ( !image->img )
+		if ( best == UINT32_MAX )
 		{
-			std::println( stderr, "Failed to open image: {}", filepath );
-			return RESULT_CODE_FAILED_TO_OPEN_IMAGE;
+			best = (u32)pages.size();
+			pages.push_back( { 0, std::vector<u8>( sceneCount, 0 ) } );
 		}
+
+		pages[ best ].used += unit.area;
+
+		for ( u32 scene : *unit.scenes )
+			pages[ best ].hasScene[ scene ] = 1;
+
+		for ( u32 sprite : unit.sprites )
+			spritePage[ sprite ] = best;
 	}
 
-	return ret;
+	return (u32)pages.size();
 }
 
-RESULT_CODE process_texturegroup( const char *path, App *app, Data *data )
+// Packs the sprites of the usage groups onto pages by the scenes that draw them and writes <usage>.json
+// with the pages and the texture switches of every scene, against keeping the groups apart.
+static RESULT_CODE process_usage_pages( const char *inputPath, const std::string &usageName, const std::vector<UsageScene> &scenes,
+	const std::vector<std::string> &groups, bool report, App *app, Data *data )
 {
-	if ( app->verbose )
-		std::println( "Processing: {}", path );
-
 	RESULT_CODE ret = RESULT_CODE_SUCCESS;
 
-	std::unordered_map<std::string, u64> map;
-	Group group;
-	std::vector<stbrp_rect> rects;
-	std::vector<TexpackSpriteNamed> texpackSprite;
+	// the sizes come from the png headers and datafiles as in plan mode, problems are reported when the pages are read
+	Data planData = *data;
+	planData.plan = true;
 
-	ImageFilesData imgData =
+	App quiet = *app;
+	quiet.verbose = false;
+
+	std::vector<UsageSprite> sprites;
+	std::unordered_map<std::string, u32> spriteIndex;
+
+	for ( u32 g = 0; g < groups.size() && ret == RESULT_CODE_SUCCESS; ++g )
 	{
-		.map = map,
-		.group = group,
-		.rects = rects,
-		.texpackSprite = texpackSprite,
-	};
+		arena_reset( &groupArena );
 
-	constexpr i32 reserveAmount = 1024;
-	group.diffuse.reserve( reserveAmount );
-	group.normal.reserve( reserveAmount );
-	group.emissive.reserve( reserveAmount );
-	rects.reserve( reserveAmount );
+		ArenaResource resource( &groupArena );
 
-	ret = image_files( path, app, data, &imgData );
-	if ( ret != RESULT_CODE_SUCCESS )
-		return ret;
+		Group group =
+		{
+			.diffuse = std::pmr::vector<Image>( &resource ),
+			.normal = std::pmr::vector<Image>( &resource ),
+			.emissive = std::pmr::vector<Image>( &resource ),
+			.normalIndex = { .slots = std::pmr::vector<NameIndex::Slot>( &resource ), .count = 0 },
+			.emissiveIndex = { .slots = std::pmr::vector<NameIndex::Slot>( &resource ), .count = 0 },
+			.colliders = std::pmr::vector<GenCollisionData>( &resource ),
+			.meshVertices = std::pmr::vector<vec2>( &resource ),
+		};
+		std::pmr::vector<stbrp_rect> rects( &resource );
+		std::pmr::vector<TexpackSpriteNamed> texpackSprite( &resource );
+
+		ImageFilesData imgData =
+		{
+			.group = group,
+			.rects = rects,
+			.texpackSprite = texpackSprite,
+			.prefix = groups[ g ] + "/",
+			.page = nullptr,
+		};
 
-	stbrp_context context;
+		ret = image_files( ( std::string( inputPath ) + "/" + groups[ g ] ).c_str(), &quiet, &planData, &imgData );
 
-	std::vector<stbrp_node> nodes;
-	nodes.resize( data->textureWidth );
+		for ( const TexpackSpriteNamed &spr : texpackSprite )
+		{
+			UsageSprite &sprite = sprites.emplace_back();
+			sprite.name = spr.name;
+			sprite.group = g;
+			sprite.area = 0;
 
-	stbrp_init_target( &context, data->textureWidth, data->textureHeight, nodes.data(), (i32)nodes.size() );
+			for ( u32 r = 0, count = spr.sprite.hasFrameUVs ? spr.sprite.frameCount : 1; r < count; ++r )
+			{
+				const stbrp_rect &rect = rects[ spr.firstRect + r ];
+				sprite.rects.push_back( { rect.w, rect.h } );
+				sprite.area += (u64)rect.w * rect.h;
+			}
 
-	if ( stbrp_pack_rects( &context, rects.data(), (i32)rects.size() ) == 0 )
-	{
-		// TODO : in future could possible make another texture for the overflowed ones
-		std::println( stderr, "Failed to pack all images. ({})", path );
-		return RESULT_CODE_FAILED_TO_PACK_ALL;
+			spriteIndex.emplace( sprite.name, (u32)sprites.size() - 1 );
+		}
 	}
 
-	if ( app->verbose )
-		std::println( "Creating blank images. {}", path );
-
-	u64 totalBytes = data->textureWidth * data->textureHeight * data->outputChannels;
+	if ( ret != RESULT_CODE_SUCCESS )
+		return ret;
 
-	std::vector<u8> diffuseImage;
+	for ( u32 s = 0; s < scenes.size(); ++s )
 	{
-		diffuseImage.resize( totalBytes );
-		u8 *img = diffuseImage.data();
-		for ( u64 i = 0; i < totalBytes; i += 4 )
+		for ( const std::string &name : scenes[ s ].sprites )
 		{
-			*img++ = 255;		// magenta - although if alpha is respected it wont be seen
-			*img++ = 0;
-			*img++ = 255;
-			*img++ = 0;
+			auto found = spriteIndex.find( name );
+
+			if ( found == spriteIndex.end() )
+			{
+				if ( report )
+				{
+					std::println( stderr, "Usage sprite not found: {} (scene {})", name, scenes[ s ].name );
+					app->problems += 1;
+				}
+				continue;
+			}
+
+			std::vector<u32> &spriteScenes = sprites[ found->second ].scenes;
+			if ( spriteScenes.empty() || spriteScenes.back() != s )
+				spriteScenes.push_back( s );
 		}
 	}
 
-	std::vector<u8> normalImage;
+	// no page can hold a sprite larger than the texture
+	for ( const UsageSprite &sprite : sprites )
 	{
-		normalImage.resize( totalBytes );
-		u8 *img = normalImage.data();
-		for ( u64 i = 0; i < totalBytes; i += 4 )
+		for ( const ivec2 &size : sprite.rects )
 		{
-			*img++ = 128;
-			*img++ = 128;
-			*img++ = 255;
-			*img++ = 255;
+			if ( size.x > data->textureWidth || size.y > data->textureHeight )
+			{
+				std::println( stderr, "Usage sprite {} ({}x{}) is larger than the texture ({}x{})", sprite.name, size.x, size.y, data->textureWidth, data->textureHeight );
+				return RESULT_CODE_FAILED_TO_PACK_ALL;
+			}
 		}
 	}
 
-	std::vector<u8> emissiveImage;
-	{
-		emissiveImage.resize( totalBytes );
-		u8 *img = emissiveImage.data();
-		memset( img, 0, totalBytes );
-	}
+	// the rect area is a guess at what fits, a page that does not pack lowers it for every page
+	constexpr u32 maxAttempts = 16;
 
-	std::string textureName;
-	auto tn = fs::path( path ).filename().u8string();
-	textureName.assign( reinterpret_cast<const char*>( tn.data() ), tn.size() );
+	std::vector<u32> spritePage;
+	std::pmr::vector<stbrp_rect> pageRects;
+	std::vector<u8> rotated;
+	u64 capacity = (u64)data->textureWidth * data->textureHeight;
+	u32 pageCount = 0;
+	u32 failedPage = 0;
+	bool fits = false;
 
-	std::string outputName;
-	outputName.reserve( 4096 );
+	for ( u32 attempt = 0; attempt < maxAttempts && !fits; ++attempt )
+	{
+		pageCount = partition_usage( sprites, (u32)scenes.size(), capacity, spritePage );
 
-	outputName += data->outputName;
-	outputName += "/";
-	outputName += textureName;
+		fits = true;
 
-	std::ofstream dataFile( outputName + ".dat", std::ios::binary );
-	if ( !dataFile.good() )
-	{
-		std::println( stderr, "Failed to create data file: {}.dat", outputName );
-		return RESULT_CODE_FAILED_TO_CREATE_DATA_FILE;
-	}
+		for ( u32 p = 0; p < pageCount && fits; ++p )
+		{
+			pageRects.clear();
 
-	std::string diffuseName = outputName + ".png";
-	std::string normalName = outputName + "_n.png";
-	std::string emissiveName = outputName + "_e.png";
+			for ( u32 s = 0; s < sprites.size(); ++s )
+			{
+				if ( spritePage[ s ] == p )
+				{
+					for ( const ivec2 &size : sprites[ s ].rects )
+					{
+						stbrp_rect *rect = &pageRects.emplace_back();
+						rect->id = (i32)s;
+						rect->w = size.x;
+						rect->h = size.y;
+					}
+				}
+			}
 
-	TexpackTexture texpackTexture;
-	texpackTexture.size = { data->textureWidth, data->textureHeight };
-	texpackTexture.numSprites = (u32)rects.size();
+			// the same packing as the page gets, so a forced grid or rotation is checked too
+			fits = pack_rects( &quiet, &planData, pageRects, rotated );
+			failedPage = p;
+		}
 
-	f32 tw = (f32)data->textureWidth;
-	f32 th = (f32)data->textureHeight;
+		capacity = capacity * 9 / 10;
+	}
 
-	for ( u64 i = 0, count = rects.size(); i < count; ++i )
+	// pageRects still holds the page that failed last
+	if ( !fits )
 	{
-		Image diffuse = group.diffuse[ i ];
-		Image normal = {};
-		Image emissive = {};
+		auto unpacked = std::find_if( pageRects.begin(), pageRects.end(), []( const stbrp_rect &rect ) { return !rect.was_packed; } );
+		const stbrp_rect &rect = unpacked != pageRects.end() ? *unpacked : pageRects.front();
 
-		TexpackSpriteNamed *spr = &texpackSprite[ i ];
+		std::println( stderr, "Usage page {}_{} does not pack into the texture ({}x{}) after {} tries, {} ({}x{}) is left over",
+			usageName, failedPage, data->textureWidth, data->textureHeight, maxAttempts, sprites[ rect.id ].name, rect.w, rect.h );
+		return RESULT_CODE_FAILED_TO_PACK_ALL;
+	}
 
-		if ( auto iter = map.find( diffuse.filename + "_n" ); iter != map.end() )
-		{
-			normal = group.normal[ iter->second ];
-		}
+	std::vector<UsagePage> pages( pageCount );
 
-		if ( auto iter = map.find( diffuse.filename + "_e" ); iter != map.end() )
-		{
-			emissive = group.emissive[ iter->second ];
-		}
+	for ( u32 p = 0; p < pageCount; ++p )
+		pages[ p ].name = std::format( "{}_{}", usageName, p );
 
-		stbrp_rect rect = rects[ i ];
+	for ( u32 s = 0; s < sprites.size(); ++s )
+	{
+		UsagePage &page = pages[ spritePage[ s ] ];
+		const std::string &group = groups[ sprites[ s ].group ];
 
-		i32 margin = diffuse.margin;
-		i32 padding = diffuse.padding;
+		if ( page.groups.empty() || page.groups.back() != group )
+			page.groups.push_back( group );
 
-		i32 offX = rect.x + margin + padding;
-		i32 offY = rect.y + margin + padding;
-		i32 inputTextureW = ( rect.w - ( margin * 2 + padding * 2 * spr->sprite.frameCount ) );
-		i32 frameW = inputTextureW / spr->sprite.frameCount;
-		i32 frameH = rect.h - ( margin + padding ) * 2;
-		bool isTranslucent = false;
+		page.sprites.insert( sprites[ s ].name );
+	}
 
-		if ( normal.img && ( ( normal.width / spr->sprite.frameCount ) != frameW || normal.height != frameH ) )
-		{
-			std::println( stderr, "Normal texture should be same size as diffuse texture." );
-			return RESULT_CODE_NORMAL_TEXTURE_NOT_SAME_SIZE_AS_DIFFUSE;
-		}
+	for ( u32 p = 0; p < pageCount && ret == RESULT_CODE_SUCCESS; ++p )
+	{
+		ret = process_texturegroup( inputPath, app, data, nullptr, 0, &pages[ p ] );
+		decodeShare.images.clear();
+	}
 
-		if ( emissive.img && ( ( emissive.width / spr->sprite.frameCount ) != frameW || emissive.height != frameH ) )
-		{
-			std::println( stderr, "Emissive texture should be same size as diffuse texture." );
-			return RESULT_CODE_EMISSIVE_TEXTURE_NOT_SAME_SIZE_AS_DIFFUSE;
-		}
+	if ( ret != RESULT_CODE_SUCCESS || data->plan )
+		return ret;
 
-		for ( i32 frame = 0; frame < spr->sprite.frameCount; ++frame )
-		{
-			i32 frameOffX = offX + frame * ( frameW + padding * 2 );
-			i32 frameOffY = offY;
+	std::string out = std::format( "{{\n\t\"version\": \"{}.{}.{}\",\n\t\"pages\":\n\t[\n", VERSION_MAJOR, VERSION_MINOR, VERSION_REVISION );
 
-			if ( app->verbose )
-				std::println( "Rendering diffuse image for {} (frame: {})", diffuse.filename, frame );
+	for ( u32 p = 0; p < pageCount; ++p )
+	{
+		out += std::format( "\t\t{{ \"name\": {}, \"sprites\": {}, \"groups\": [ ", json_string( pages[ p ].name ), pages[ p ].sprites.size() );
+		for ( u64 g = 0; g < pages[ p ].groups.size(); ++g )
+			out += std::format( "{}{}", g > 0 ? ", " : "", json_string( pages[ p ].groups[ g ] ) );
+		out += std::format( " ] }}{}\n", p + 1 < pageCount ? "," : "" );
+	}
 
-			isTranslucent = render_image( diffuseImage, frameOffX, frameOffY, frameW, frameH, diffuse.img, diffuse.imgSize, frame, inputTextureW, diffuse.channels, data ) || isTranslucent;
+	out += "\t],\n\t\"scenes\":\n\t[\n";
 
-			if ( normal.img )
-			{
-				if ( app->verbose )
-					std::println( "Rendering normal image for {} (frame: {})", diffuse.filename, frame );
+	// a scene drawing from k textures switches k - 1 times when its draws are sorted by texture
+	u64 totalSwitches = 0;
+	u64 totalGroupSwitches = 0;
+	std::vector<u32> scenePages;
+	std::vector<u32> sceneGroups;
 
-				isTranslucent = render_image( normalImage, frameOffX, frameOffY, frameW, frameH, normal.img, normal.imgSize, frame, inputTextureW, normal.channels, data ) || isTranslucent;
-			}
+	for ( u32 s = 0; s < scenes.size(); ++s )
+	{
+		scenePages.clear();
+		sceneGroups.clear();
 
-			if ( emissive.img )
+		for ( const std::string &name : scenes[ s ].sprites )
+		{
+			if ( auto found = spriteIndex.find( name ); found != spriteIndex.end() )
 			{
-				if ( app->verbose )
-					std::println( "Rendering emissive image for {} (frame: {})", diffuse.filename, frame );
-
-				isTranslucent = render_image( emissiveImage, frameOffX, frameOffY, frameW, frameH, emissive.img, emissive.imgSize, frame, inputTextureW, emissive.channels, data ) || isTranslucent;
+				scenePages.push_back( spritePage[ found->second ] );
+				sceneGroups.push_back( sprites[ found->second ].group );
 			}
 		}
 
-		spr->name = diffuse.filename;
+		std::sort( scenePages.begin(), scenePages.end() );
+		scenePages.erase( std::unique( scenePages.begin(), scenePages.end() ), scenePages.end() );
+		std::sort( sceneGroups.begin(), sceneGroups.end() );
+		sceneGroups.erase( std::unique( sceneGroups.begin(), sceneGroups.end() ), sceneGroups.end() );
 
-		offX = rect.x + margin;
-		offY = rect.y + margin;
-		frameW = frameW + padding * 2;
-		frameH = frameH + padding * 2;
+		u64 switches = scenePages.empty() ? 0 : scenePages.size() - 1;
+		u64 groupSwitches = sceneGroups.empty() ? 0 : sceneGroups.size() - 1;
+		totalSwitches += switches;
+		totalGroupSwitches += groupSwitches;
 
-		spr->sprite.uvs = { offX / tw, offY / th, ( offX + frameW ) / tw, ( offY + frameH ) / th };
-		spr->sprite.size = { frameW, frameH };
-		spr->sprite.isTranslucent = isTranslucent;
+		out += std::format( "\t\t{{ \"name\": {}, \"sprites\": {}, \"switches\": {}, \"groupSwitches\": {}, \"pages\": [ ",
+			json_string( scenes[ s ].name ), scenes[ s ].sprites.size(), switches, groupSwitches );
+		for ( u64 p = 0; p < scenePages.size(); ++p )
+			out += std::format( "{}{}", p > 0 ? ", " : "", json_string( pages[ scenePages[ p ] ].name ) );
+		out += std::format( " ] }}{}\n", s + 1 < scenes.size() ? "," : "" );
 
-		stbi_image_free( diffuse.img );
-		diffuse.img = nullptr;
+		if ( app->verbose )
+			std::println( "Scene {}: {} pages, {} switches ({} with the groups apart)", scenes[ s ].name, scenePages.size(), switches, groupSwitches );
+	}
 
-		if ( normal.img )
-		{
-			stbi_image_free( normal.img );
-			normal.img = nullptr;
-		}
+	out += std::format( "\t],\n\t\"switches\": {},\n\t\"groupSwitches\": {}\n}}\n", totalSwitches, totalGroupSwitches );
 
-		if ( emissive.img )
-		{
-			stbi_image_free( emissive.img );
-			emissive.img = nullptr;
-		}
+	std::string reportName = data->outputName + "/" + usageName + ".json";
+	std::ofstream reportFile( reportName, std::ios::binary );
+	reportFile.write( out.data(), out.size() );
+
+	if ( !reportFile.good() )
+	{
+		std::println( stderr, "Failed to write usage report: {}", reportName );
+		app->problems += 1;
+		return ret;
 	}
 
-	std::println( "Saving texture: {}", diffuseName );
+	std::println( "Usage: {} sprites of {} groups on {} pages, {} texture switches over {} scenes ({} with the groups apart): {}",
+		sprites.size(), groups.size(), pageCount, totalSwitches, scenes.size(), totalGroupSwitches, reportName );
+
+	return ret;
+}
 
-	stbi_write_png( diffuseName.c_str(), data->textureWidth, data->textureHeight, data->outputChannels, diffuseImage.data(), data->textureWidth * data->outputChannels );
-	stbi_write_png( normalName.c_str(), data->textureWidth, data->textureHeight, data->outputChannels, normalImage.data(), data->textureWidth * data->outputChannels );
-	stbi_write_png( emissiveName.c_str(), data->textureWidth, data->textureHeight, data->outputChannels, emissiveImage.data(), data->textureWidth * data->outputChannels );
+struct Command
+{
+	std::array<std::string, 2> command;
+	bool (*func)( char *argv[], i32 argc, int &argIdx, Data *data, App *app );
+};
 
-	TexpackHeader texpackHeader =
+std::vector<Command> commands =
+{
+	{
+		{ "-o", "--output" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			if ( argIdx == argc - 1 )
+				return false;
+			data->outputName = argv[ ++argIdx ];
+			return true;
+		}
+	},
+	{
+		{ "-w", "--width" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			if ( argIdx == argc - 1 )
+				return false;
+			data->textureWidth = atoi( argv[ ++argIdx ] );
+			return data->textureWidth > 0;
+		}
+	},
+	{
+		{ "-h", "--height" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			if ( argIdx == argc - 1 )
+				return false;
+			data->textureHeight = atoi( argv[ ++argIdx ] );
+			return data->textureHeight > 0;
+		}
+	},
+	{
+		{ "-m", "--margin" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			if ( argIdx == argc - 1 )
+				return false;
+			data->margin = atoi( argv[ ++argIdx ] );
+			return true;
+		}
+	},
+	{
+		{ "-p", "--pad" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			if ( argIdx == argc - 1 )
+				return false;
+			data->padding = atoi( argv[ ++argIdx ] );
+			return true;
+		}
+	},
+	{
+		{ "-c", "--collision" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			app->generateCollisionData.enable = true;
+			return true;
+		}
+	},
+	{
+		{ "-r", "--rotate" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			data->allowRotation = true;
+			return true;
+		}
+	},
+	{
+		{ "-F", "--split-frames" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			data->splitFrames = true;
+			return true;
+		}
+	},
+	{
+		{ "-M", "--mesh" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			if ( argIdx == argc - 1 )
+				return false;
+			data->meshVertices = atoi( argv[ ++argIdx ] );
+			return data->meshVertices >= MIN_MESH_VERTICES && data->meshVertices <= MAX_MESH_VERTICES;
+		}
+	},
+	{
+		{ "-f", "--format" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			if ( argIdx == argc - 1 )
+				return false;
+			std::string_view format = argv[ ++argIdx ];
+			if ( format == "png" )
+				data->outputFormat = OUTPUT_FORMAT_PNG;
+			else if ( format == "tex" )
+				data->outputFormat = OUTPUT_FORMAT_CONTAINER;
+			else
+				return false;
+			return true;
+		}
+	},
+	{
+		{ "-z", "--codec" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			if ( argIdx == argc - 1 )
+				return false;
+			std::string_view codec = argv[ ++argIdx ];
+			if ( codec == "none" )
+				data->codec = TEXTURE_CODEC_NONE;
+			else if ( codec == "lz4" )
+				data->codec = TEXTURE_CODEC_LZ4;
+			else if ( codec == "qoi" )
+				data->codec = TEXTURE_CODEC_QOI;
+			else
+				return false;
+			return true;
+		}
+	},
+	{
+		{ "-b", "--bundle" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			data->bundle = true;
+			data->outputFormat = OUTPUT_FORMAT_CONTAINER;
+			return true;
+		}
+	},
+	{
+		{ "-H", "--header" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			data->writeHeader = true;
+			return true;
+		}
+	},
 	{
-		.magicNumber = 'PxeT',
-		.majorVersion = VERSION_MAJOR,
-		.minorVersion = VERSION_MINOR,
-		.revisionVersion = VERSION_REVISION,
-		.reserved = 0,
-	};
-
-	dataFile.write( (char*)&texpackHeader, sizeof( texpackHeader ) );
+		{ "-a", "--array" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			if ( argIdx == argc - 1 )
+				return false;
 
-	dataFile.write( textureName.c_str(), textureName.length() );
-	dataFile.write( ".png", 4 + 1 ); // +1 to write the null terminator
-	dataFile.write( (char*)&texpackTexture, sizeof( texpackTexture ) );
+			std::string_view value = argv[ ++argIdx ];
+			size_t equals = value.find( '=' );
+			if ( equals == std::string_view::npos || equals == 0 )
+				return false;
 
-	for ( u64 i = 0, count = texpackSprite.size(); i < count; ++i )
-	{
-		dataFile.write( texpackSprite[ i ].name.c_str(), texpackSprite[ i ].name.length() + 1 ); // +1 to write the null terminator
-		dataFile.write( (char*)&texpackSprite[ i ].sprite, sizeof( TexpackSprite ) );
+			TextureArrayDesc desc;
+			desc.name = value.substr( 0, equals );
 
-		if ( texpackSprite[ i ].sprite.colliderCount > 0 )
-		{
-			const Image *diffuse = &group.diffuse[ i ];
+			for ( const TextureArrayDesc &array : data->arrays )
+			{
+				if ( array.name == desc.name )
+				{
+					std::println( stderr, "Texture array {} is listed twice.", desc.name );
+					return false;
+				}
+			}
 
-			for ( i32 colIdx = 0, colCount = diffuse->colliderCount; colIdx < colCount; ++colIdx )
+			for ( std::string_view groups = value.substr( equals + 1 ); !groups.empty(); )
 			{
-				const GenCollisionData *col = &diffuse->genColData[ colIdx ];
+				size_t comma = groups.find( ',' );
+				std::string_view group = groups.substr( 0, comma );
+				if ( group.empty() || desc.groups.size() == UINT16_MAX )
+					return false;
 
-				switch ( col->type )
+				// a group is packed once, so it can only be one layer of one array
+				if ( std::find( desc.groups.begin(), desc.groups.end(), group ) != desc.groups.end() )
 				{
-				case GEN_COLLISION_DATA_TYPE_RECT_AUTO:
-				case GEN_COLLISION_DATA_TYPE_RECT_FULL:
-				case GEN_COLLISION_DATA_TYPE_RECT_MANUAL:
-					{
-						u8 colliderType = COLLIDER_TYPE_RECT;
-						dataFile.write( (char*)&colliderType, sizeof( colliderType ) );
-						dataFile.write( (char*)&col->area, sizeof( col->area ) );
-					}
-					break;
+					std::println( stderr, "Group {} is listed twice in texture array {}.", group, desc.name );
+					return false;
+				}
 
-				case GEN_COLLISION_DATA_TYPE_CIRCLE_AUTO:
-				case GEN_COLLISION_DATA_TYPE_CIRCLE_AUTO_ENCOMPASS:
-				case GEN_COLLISION_DATA_TYPE_CIRCLE_MANUAL:
+				for ( const TextureArrayDesc &array : data->arrays )
+				{
+					if ( std::find( array.groups.begin(), array.groups.end(), group ) != array.groups.end() )
 					{
-						u8 colliderType = COLLIDER_TYPE_CIRCLE;
-						dataFile.write( (char*)&colliderType, sizeof( colliderType ) );
-						dataFile.write( (char*)&col->position, sizeof( col->position ) );
-						dataFile.write( (char*)&col->radius, sizeof( col->radius ) );
+						std::println( stderr, "Group {} is in both texture array {} and {}.", group, array.name, desc.name );
+						return false;
 					}
-					break;
 				}
-			}
-		}
-	}
 
-	return ret;
-}
+				desc.groups.emplace_back( group );
+				groups = comma == std::string_view::npos ? std::string_view() : groups.substr( comma + 1 );
+			}
 
-struct Command
-{
-	std::array<std::string, 2> command;
-	bool (*func)( char *argv[], i32 argc, int &argIdx, Data *data, App *app );
-};
+			if ( desc.groups.empty() )
+				return false;
 
-std::vector<Command> commands =
-{
+			data->arrays.push_back( std::move( desc ) );
+			return true;
+		}
+	},
 	{
-		{ "-o", "--output" },
+		{ "-T", "--cutout" },
 		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
 		{
 			if ( argIdx == argc - 1 )
 				return false;
-			data->outputName = argv[ ++argIdx ];
+			data->cutoutTolerance = atoi( argv[ ++argIdx ] );
+			return data->cutoutTolerance >= 0 && data->cutoutTolerance <= 127;
+		}
+	},
+	{
+		{ "-P", "--premultiply" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			data->premultiply = true;
 			return true;
 		}
 	},
 	{
-		{ "-w", "--width" },
+		{ "-d", "--dilate" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			data->dilate = true;
+			return true;
+		}
+	},
+	{
+		{ "-O", "--group-opacity" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			data->groupOpacity = true;
+			return true;
+		}
+	},
+	{
+		{ "-R", "--route" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			data->routeChannels = true;
+			return true;
+		}
+	},
+	{
+		{ "-G", "--grid" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			data->grid = true;
+			return true;
+		}
+	},
+	{
+		{ "-x", "--profiles" },
 		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
 		{
 			if ( argIdx == argc - 1 )
 				return false;
-			data->textureWidth = atoi( argv[ ++argIdx ] );
-			return data->textureWidth > 0;
+			data->profilePath = argv[ ++argIdx ];
+			return true;
 		}
 	},
 	{
-		{ "-h", "--height" },
+		{ "-u", "--usage" },
 		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
 		{
 			if ( argIdx == argc - 1 )
 				return false;
-			data->textureHeight = atoi( argv[ ++argIdx ] );
-			return data->textureHeight > 0;
+			data->usagePath = argv[ ++argIdx ];
+			return true;
 		}
 	},
 	{
-		{ "-m", "--margin" },
+		{ "-n", "--plan" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			data->plan = true;
+			return true;
+		}
+	},
+	{
+		{ "-s", "--stable" },
 		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
 		{
 			if ( argIdx == argc - 1 )
 				return false;
-			data->margin = atoi( argv[ ++argIdx ] );
-			return true;
+			data->stable = true;
+			data->stableThreshold = atoi( argv[ ++argIdx ] );
+			return data->stableThreshold >= 0 && data->stableThreshold <= 100;
 		}
 	},
 	{
-		{ "-p", "--pad" },
+		{ "-t", "--tiles" },
 		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
 		{
 			if ( argIdx == argc - 1 )
 				return false;
-			data->padding = atoi( argv[ ++argIdx ] );
-			return true;
+			data->tileSize = atoi( argv[ ++argIdx ] );
+			return data->tileSize >= 8 && data->tileSize <= 4096;
 		}
 	},
 	{
-		{ "-c", "--collision" },
+		{ "-g", "--tile-gutter" },
 		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
 		{
-			app->generateCollisionData.enable = true;
-			return true;
+			if ( argIdx == argc - 1 )
+				return false;
+			data->tileGutter = atoi( argv[ ++argIdx ] );
+			return data->tileGutter >= 0 && data->tileGutter <= 256;
+		}
+	},
+	{
+		{ "-q", "--io-depth" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			if ( argIdx == argc - 1 )
+				return false;
+			i32 depth = atoi( argv[ ++argIdx ] );
+			data->ioDepth = (u32)depth;
+			return depth >= 0 && depth <= 256;
+		}
+	},
+	{
+		{ "-C", "--cache" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			if ( argIdx == argc - 1 )
+				return false;
+			data->cachePath = argv[ ++argIdx ];
+			return !data->cachePath.empty();
+		}
+	},
+	{
+		{ "-S", "--shard" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app )
+		{
+			if ( argIdx == argc - 1 )
+				return false;
+
+			std::string_view value = argv[ ++argIdx ];
+			size_t slash = value.find( '/' );
+			if ( slash == std::string_view::npos )
+				return false;
+
+			auto index = std::from_chars( value.data(), value.data() + slash, data->shardIndex );
+			auto count = std::from_chars( value.data() + slash + 1, value.data() + value.size(), data->shardCount );
+
+			return index.ptr == value.data() + slash && count.ptr == value.data() + value.size()
+				&& data->shardCount > 0 && data->shardIndex >= 1 && data->shardIndex <= data->shardCount;
+		}
+	},
+	{
+		{ "-j", "--merge" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app ) -> bool
+		{
+			if ( argIdx == argc - 1 )
+				return false;
+			RESULT_CODE code = merge_shards( argv[ ++argIdx ] );
+			if ( code != RESULT_CODE_SUCCESS )
+				usage( code );
+			exit( RESULT_CODE_SUCCESS );
+		}
+	},
+	{
+		{ "-B", "--bench-pack" },
+		[]( char *argv[], i32 argc, int &argIdx, Data *data, App *app ) -> bool
+		{
+			benchmark_packer();
+			exit( RESULT_CODE_SUCCESS );
 		}
 	},
 	{
@@ -965,14 +6359,44 @@ int main( int argc, char *argv[] )
 		} );
 
 		if ( find != commands.end() )
+		{
+			int first = argIdx;
+
 			if ( !find->func( argv, argc, argIdx, &data, &app ) )
 				usage( RESULT_CODE_INVALID_ARGUMENTS );
+
+			// paths, logging and how the work is split do not change the outputs
+			static constexpr std::string_view ignored[] = { "-o", "-v", "-q", "-C", "-S" };
+
+			if ( std::find( std::begin( ignored ), std::end( ignored ), find->command[ 0 ] ) == std::end( ignored ) )
+			{
+				for ( int i = first; i <= argIdx; ++i )
+					app.options += app.options.empty() ? argv[ i ] : std::format( " {}", argv[ i ] );
+			}
+		}
 	}
 
-	if ( data.textureWidth == 0 || data.textureHeight == 0 )
-	{
-		std::println( stderr, "Width and height should be > 0 ({}x{})", data.textureWidth, data.textureHeight );
+	// without profiles the command line is the only profile and writes straight into the output folder
+	std::vector<Data> profiles;
+
+	if ( data.profilePath.empty() )
+		profiles.push_back( data );
+	else if ( !read_profiles( data.profilePath, data, profiles ) )
 		usage( RESULT_CODE_INVALID_ARGUMENTS );
+
+	for ( const Data &profile : profiles )
+	{
+		if ( profile.textureWidth == 0 || profile.textureHeight == 0 )
+		{
+			std::println( stderr, "Width and height should be > 0 ({}x{})", profile.textureWidth, profile.textureHeight );
+			usage( RESULT_CODE_INVALID_ARGUMENTS );
+		}
+
+		if ( profile.pixelFormat == PIXEL_FORMAT_RGBA4444 && ( profile.outputFormat != OUTPUT_FORMAT_CONTAINER || profile.tileSize > 0 ) )
+		{
+			std::println( stderr, "RGBA4444 is only written to tex textures, not png or tiles (profile {}).", profile.profileName );
+			usage( RESULT_CODE_INVALID_ARGUMENTS );
+		}
 	}
 
 	if ( argc < 2 )
@@ -981,16 +6405,96 @@ int main( int argc, char *argv[] )
 		usage( RESULT_CODE_INVALID_ARGUMENTS );
 	}
 
+	if ( data.shardCount > 0 && data.plan )
+	{
+		std::println( stderr, "A plan covers every group and can not be sharded." );
+		usage( RESULT_CODE_INVALID_ARGUMENTS );
+	}
+
+	if ( data.dilate && data.premultiply )
+	{
+		std::println( stderr, "Dilation fills the colour that premultiplying sets back to 0, use one or the other." );
+		usage( RESULT_CODE_INVALID_ARGUMENTS );
+	}
+
+	// profiles write into their own folders, which the plan and the shard manifests do not know about
+	if ( !data.profilePath.empty() && ( data.plan || data.shardCount > 0 ) )
+	{
+		std::println( stderr, "Profiles can not be used with a plan or shards." );
+		usage( RESULT_CODE_INVALID_ARGUMENTS );
+	}
+
+	// the groups of the usage file are packed as pages after the other groups
+	std::vector<UsageScene> scenes;
+	std::vector<std::string> usageGroups;
+	std::string usageName;
+
+	if ( !data.usagePath.empty() )
+	{
+		if ( data.shardCount > 0 )
+		{
+			std::println( stderr, "Usage pages can not be sharded." );
+			usage( RESULT_CODE_INVALID_ARGUMENTS );
+		}
+
+		// the pages are split before any pixels are decoded, so the opacity bands can not be checked
+		if ( data.groupOpacity )
+		{
+			std::println( stderr, "Usage pages can not be packed in opacity bands." );
+			usage( RESULT_CODE_INVALID_ARGUMENTS );
+		}
+
+		if ( !read_usage( data.usagePath, scenes, usageGroups ) )
+			usage( RESULT_CODE_INVALID_ARGUMENTS );
+
+		for ( const TextureArrayDesc &array : data.arrays )
+		{
+			for ( const std::string &group : array.groups )
+			{
+				if ( std::binary_search( usageGroups.begin(), usageGroups.end(), group ) )
+				{
+					std::println( stderr, "Group {} is in both texture array {} and the usage file.", group, array.name );
+					usage( RESULT_CODE_INVALID_ARGUMENTS );
+				}
+			}
+		}
+
+		auto un = fs::path( data.usagePath ).stem().u8string();
+		usageName.assign( reinterpret_cast<const char*>( un.data() ), un.size() );
+	}
+
+	if ( data.routeChannels && ( !data.arrays.empty() || data.tileSize > 0 || data.stable ) )
+	{
+		std::println( stderr, "Channel routing does not work with texture arrays, tiles or a stable layout." );
+		usage( RESULT_CODE_INVALID_ARGUMENTS );
+	}
+
 	const char *inputPath = argv[ 1 ];
 
 	std::println( "Input: {}", inputPath );
 
-	// output folder
-	if ( fs::path parentDir = fs::path( data.outputName ).parent_path(); !parentDir.empty() )
+	// the sprites of a missing group are reported as not found with the pages
+	std::erase_if( usageGroups, [ inputPath, &app ]( const std::string &group )
+	{
+		if ( fs::is_directory( fs::path( inputPath ) / group ) )
+			return false;
+
+		std::println( stderr, "Usage group not found: {}", group );
+		app.problems += 1;
+		return true;
+	} );
+
+	// output folder, each profile writes into a folder of its own
+	for ( const Data &profile : profiles )
 	{
+		fs::path folder = profile.profileName.empty() ? fs::path( profile.outputName ).parent_path() : fs::path( profile.outputName );
+
+		if ( folder.empty() )
+			continue;
+
 		std::error_code ec;
 
-		fs::create_directories( parentDir, ec );
+		fs::create_directories( folder, ec );
 
 		if ( ec )
 		{
@@ -1011,8 +6515,42 @@ int main( int argc, char *argv[] )
 	std::string filepath;
 	filepath.reserve( 4096 );
 
+	// layers are filled in as their groups come up in the loop below, every profile has its own arrays
+	std::vector<std::vector<Output>> arrays( profiles.size(), std::vector<Output>( data.arrays.size() ) );
+
+	for ( std::vector<Output> &profileArrays : arrays )
+	{
+		for ( u64 a = 0; a < data.arrays.size(); ++a )
+		{
+			u64 layerCount = data.arrays[ a ].groups.size();
+			profileArrays[ a ].name = data.arrays[ a ].name;
+			profileArrays[ a ].isArray = true;
+			profileArrays[ a ].diffuse.resize( layerCount );
+			profileArrays[ a ].normal.resize( layerCount );
+			profileArrays[ a ].emissive.resize( layerCount );
+		}
+	}
+
+	std::unordered_set<std::string> shardGroups;
+	std::vector<u8> shardArrays;
+
+	if ( data.shardCount > 0 )
+	{
+		shard_groups( inputPath, &data, shardGroups, shardArrays );
+
+		// shards running side by side must not replace each others cache
+		if ( !data.cachePath.empty() )
+			data.cachePath += std::format( ".{}", data.shardIndex );
+	}
+
+	// plan mode never decodes, so it has nothing to cache
+	if ( !data.cachePath.empty() && !data.plan )
+		image_cache_open( data.cachePath );
+
+	decodeShare.enabled = profiles.size() > 1;
+
 	// Cycle the top layer of folders (These are the texturegroups)
-	for ( const auto &entry : fs::directory_iterator( inputPath ) )
+	for ( const fs::directory_entry &entry : sorted_entries( inputPath, false ) )
 	{
 		entrypath = entry.path();
 
@@ -1021,12 +6559,38 @@ int main( int argc, char *argv[] )
 
 		if ( entry.is_directory() )
 		{
+			if ( data.shardCount > 0 && !shardGroups.contains( filename ) )
+				continue;
+
+			if ( std::binary_search( usageGroups.begin(), usageGroups.end(), filename ) )
+				continue;
+
 			if ( filename != "." && filename != ".." )
 			{
 				auto fp = entrypath.u8string();
 				filepath.assign( reinterpret_cast<const char*>( fp.data() ), fp.size() );
 
-				ret = process_texturegroup( filepath.c_str(), &app, &data );
+				u64 arrayIndex = data.arrays.size();
+				u16 layer = 0;
+
+				for ( u64 a = 0; a < data.arrays.size() && arrayIndex == data.arrays.size(); ++a )
+				{
+					auto found = std::find( data.arrays[ a ].groups.begin(), data.arrays[ a ].groups.end(), filename );
+					if ( found != data.arrays[ a ].groups.end() )
+					{
+						arrayIndex = a;
+						layer = (u16)( found - data.arrays[ a ].groups.begin() );
+					}
+				}
+
+				// the first profile decodes the group, the others copy its pixels
+				for ( u64 p = 0; p < profiles.size() && ret == RESULT_CODE_SUCCESS; ++p )
+				{
+					Output *array = arrayIndex < data.arrays.size() ? &arrays[ p ][ arrayIndex ] : nullptr;
+					ret = process_texturegroup( filepath.c_str(), &app, &profiles[ p ], array, layer, nullptr );
+				}
+
+				decodeShare.images.clear();
 
 				if ( ret != RESULT_CODE_SUCCESS )
 					break;
@@ -1038,9 +6602,74 @@ int main( int argc, char *argv[] )
 		}
 	}
 
+	for ( u64 p = 0; p < profiles.size() && ret == RESULT_CODE_SUCCESS && !scenes.empty(); ++p )
+		ret = process_usage_pages( inputPath, usageName, scenes, usageGroups, p == 0, &app, &profiles[ p ] );
+
+	if ( data.plan && ret == RESULT_CODE_SUCCESS )
+	{
+		std::string planName = data.outputName + "/plan.json";
+		std::string plan = std::format( "{{\n\t\"version\": \"{}.{}.{}\",\n\t\"width\": {},\n\t\"height\": {},\n\t\"groups\":\n\t[\n{}\n\t]\n}}\n",
+			VERSION_MAJOR, VERSION_MINOR, VERSION_REVISION, data.textureWidth, data.textureHeight, app.planGroups );
+
+		std::ofstream planFile( planName, std::ios::binary );
+		planFile.write( plan.data(), plan.size() );
+
+		if ( !planFile.good() )
+		{
+			std::println( stderr, "Failed to write plan: {}", planName );
+			app.problems += 1;
+		}
+		else
+		{
+			std::println( "Saving plan: {}", planName );
+		}
+	}
+
+	// plan mode leaves the array layers empty, there is nothing to write
+	for ( u64 a = 0; a < data.arrays.size() && ret == RESULT_CODE_SUCCESS && !data.plan; ++a )
+	{
+		if ( data.shardCount > 0 && !shardArrays[ a ] )
+			continue;
+
+		bool complete = true;
+
+		for ( u64 layer = 0; layer < arrays[ 0 ][ a ].diffuse.size(); ++layer )
+		{
+			if ( arrays[ 0 ][ a ].diffuse[ layer ].empty() )
+			{
+				std::println( stderr, "Texture array {} group not found: {}", arrays[ 0 ][ a ].name, data.arrays[ a ].groups[ layer ] );
+				app.problems += 1;
+				complete = false;
+			}
+		}
+
+		for ( u64 p = 0; p < profiles.size() && complete && ret == RESULT_CODE_SUCCESS; ++p )
+			ret = write_output( &arrays[ p ][ a ], &app, &profiles[ p ] );
+	}
+
+	if ( decodeShare.enabled )
+		std::println( "Profiles: {} written from one decode, {} images copied", profiles.size(), decodeShare.hits );
+
+	if ( !image_cache_close() )
+		app.problems += 1;
+
+	if ( data.shardCount > 0 && ret == RESULT_CODE_SUCCESS )
+	{
+		std::vector<std::string> groups( shardGroups.begin(), shardGroups.end() );
+		std::sort( groups.begin(), groups.end() );
+
+		if ( !write_shard_manifest( groups, &app, &data ) )
+			app.problems += 1;
+	}
+
 	auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::system_clock::now() - now );
 
 	std::println( "Time: {}ms", milliseconds.count() );
+	std::println( "Peak memory: {:.1f}MB (group arena peak: {:.1f}MB, {} allocations in {:.3f}ms)",
+		process_peak_memory() / ( 1024.0 * 1024.0 ), groupArena.peak / ( 1024.0 * 1024.0 ), groupArena.allocations,
+		std::chrono::duration<f64, std::milli>( groupArena.time ).count() );
+
+	arena_free( &groupArena );
 
 	if ( ret != RESULT_CODE_SUCCESS )
 		usage( ret );
@@ -1057,12 +6686,16 @@ int main( int argc, char *argv[] )
 #pragma warning( push )
 #pragma warning( disable : 4505 )
 
+#define STBI_MALLOC( size )							arena_alloc( &groupArena, size )
+#define STBI_REALLOC_SIZED( ptr, oldSize, newSize )	arena_realloc( &groupArena, ptr, oldSize, newSize )
+#define STBI_FREE( ptr )							arena_release( &groupArena, ptr )
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#define STBRP_SORT stable_qsort
 #define STB_RECT_PACK_IMPLEMENTATION
 #include "stb_rect_pack.h"
 
@@ -71,6 +71,24 @@ struct TexpackTexture
 {
 	ivec2 size;
 	u32 numSprites;
+	u8 atlasCount;
+	bool hasGrid;
+};
+
+struct TexpackAtlas
+{
+	ivec2 size;
+	u8 pixelFormat;
+};
+
+// Rect k ( one per sprite, or per frame with split frames ) is cell ( k % columns, k / columns ),
+// its sprite starts offset pixels into the cell.
+struct TexpackGrid
+{
+	ivec2 cellSize;
+	ivec2 offset;
+	u32 columns;
+	u32 count;
 };
 
 struct TexpackSprite
@@ -80,22 +98,171 @@ struct TexpackSprite
 	ivec2 origin;
 	i32 frameCount;
 	bool isTranslucent;
+	bool isRotated;
 	u16 nineslice;
 	u8 colliderCount;
+	u8 meshVertexCount;
+	u16 layer;
+	bool hasFrameUVs;
+	u8 opacity;
+	u32 tileCount;
+	f32 sdfSpread;
+	u8 atlas;
+	u8 channelUsage;
+};
+
+struct TexpackFrame
+{
+	vec4 uvs;
+	bool isRotated;
+};
+
+struct TexpackContainerHeader
+{
+	u32 magicNumber;
+	u16 majorVersion;
+	u16 minorVersion;
+	u16 revisionVersion;
+	u8 pixelFormat;
+	u8 codec;
+	ivec2 size;
+	u16 layerCount;
+	u16 mipCount;
+	u32 chunkSize;
+	u32 chunkCount;
+	u64 datOffset;
+	u64 datSize;
+};
+
+struct TexpackContainerMip
+{
+	ivec2 size;
+	u64 offset;
+	u64 dataSize;
+	u64 rawSize;
+	u32 firstChunk;
+	u32 chunkCount;
+};
+
+struct TexpackContainerChunk
+{
+	u64 offset;
+	u32 size;
+	u32 rawSize;
+};
+
+struct TexpackTileHeader
+{
+	u32 magicNumber;
+	u16 majorVersion;
+	u16 minorVersion;
+	u16 revisionVersion;
+	u8 pixelFormat;
+	u8 codec;
+	ivec2 size;
+	u16 layerCount;
+	u16 tileSize;
+	u16 gutter;
+	u16 reserved;
+	ivec2 tileCount;
+	u32 uniqueTileCount;
+	u64 datOffset;
+	u64 datSize;
+};
+
+struct TexpackTile
+{
+	u64 offset;
+	u32 size;
+};
+
+struct TexpackCacheHeader
+{
+	u32 magicNumber;
+	u16 majorVersion;
+	u16 minorVersion;
+	u16 revisionVersion;
+	u16 reserved;
+	u32 entryCount;
+	u64 indexOffset;
+};
+
+struct TexpackCacheEntry
+{
+	u64 hash;
+	u64 fileSize;
+	u64 offset;
+	u64 dataHash;
+	u32 size;
+	i32 width;
+	i32 height;
+	i32 channels;
+	ivec4 alphaBounds;
+	bool alphaOpaque;
+	bool alphaTranslucent;
+	u16 reserved;
 };
 
 #pragma pack(pop)
 
+enum OUTPUT_FORMAT : u8
+{
+	OUTPUT_FORMAT_PNG,
+	OUTPUT_FORMAT_CONTAINER,
+};
+
+enum TEXTURE_CODEC : u8
+{
+	TEXTURE_CODEC_NONE,
+	TEXTURE_CODEC_LZ4,
+	TEXTURE_CODEC_QOI,
+};
+
+enum PIXEL_FORMAT : u8
+{
+	PIXEL_FORMAT_RGBA8,
+	PIXEL_FORMAT_RGB8,
+	PIXEL_FORMAT_R8,
+	PIXEL_FORMAT_RGBA4444,	// u16 per pixel, r in the top 4 bits and a in the bottom 4
+};
+
+// What a sprite uses of its RGBA pixels, routing picks the atlas format from it.
+// A gray sprite keeps its colour in R, an alpha sprite is white and keeps its alpha in R.
+enum CHANNEL_USAGE : u8
+{
+	CHANNEL_USAGE_RGBA,
+	CHANNEL_USAGE_RGB,
+	CHANNEL_USAGE_GRAY,
+	CHANNEL_USAGE_ALPHA,
+	CHANNEL_USAGE_COUNT
+};
+
+// Ordered so the class of a sprite is the highest class of its frames.
+enum OPACITY : u8
+{
+	OPACITY_OPAQUE,
+	OPACITY_CUTOUT,
+	OPACITY_BLEND,
+	OPACITY_COUNT
+};
+
 struct TexpackSpriteNamed
 {
 	std::string name;
 	TexpackSprite sprite;
+	u32 firstRect;
+	u32 firstCollider;
+	u32 firstMeshVertex;
+	std::vector<TexpackFrame> frames;
+	std::vector<u8> frameOpacity;
+	std::vector<u32> tiles;
 };
 
 enum COLLIDER_TYPE : u32
 {
 	COLLIDER_TYPE_CIRCLE,
 	COLLIDER_TYPE_RECT,
+	COLLIDER_TYPE_MASK,
 	COLLIDER_TYPE_COUNT
 };
 
@@ -107,6 +274,7 @@ enum GEN_COLLISION_DATA_TYPE
 	GEN_COLLISION_DATA_TYPE_CIRCLE_AUTO,
 	GEN_COLLISION_DATA_TYPE_CIRCLE_AUTO_ENCOMPASS,
 	GEN_COLLISION_DATA_TYPE_CIRCLE_MANUAL,
+	GEN_COLLISION_DATA_TYPE_MASK,
 };
 
 struct GenCollisionData
@@ -116,13 +284,27 @@ struct GenCollisionData
 	ivec4 area;
 	ivec2 position;
 	i32 radius;
+	i32 threshold;
+	ivec2 maskSize;
+	std::vector<u64> mask;
 };
 
 constexpr i32 MAX_SPRITE_COLLIDERS = 16;
+constexpr i32 MIN_MESH_VERTICES = 4;
+constexpr i32 MAX_MESH_VERTICES = 255;
+
+// Whole image alpha facts stored in the image cache, a cache hit skips the scans they answer.
+struct ImageAlpha
+{
+	bool known;
+	bool opaque;		// every alpha is 255
+	bool translucent;	// some alpha is neither 0 nor 255
+	ivec4 bounds;		// inclusive, left > right when no pixel has alpha
+};
 
 struct Image
 {
-	std::string filename;
+	std::string_view filename;		// interned in the group arena
 	stbi_uc *img;
 	i32 imgSize;
 	i32 channels;
@@ -132,8 +314,13 @@ struct Image
 	i32 padding;
 	i32 frameW;
 	i32 frameH;
-	u32 colliderCount;
-	GenCollisionData genColData[ MAX_SPRITE_COLLIDERS ];
+	ImageAlpha alpha;
+};
+
+struct TextureArrayDesc
+{
+	std::string name;
+	std::vector<std::string> groups;
 };
 
 struct Data
@@ -144,6 +331,34 @@ struct Data
 	i32 textureHeight = 0;
 	i32 margin = 0;
 	i32 padding = 0;
+	bool allowRotation = false;
+	bool splitFrames = false;
+	i32 meshVertices = 0;
+	OUTPUT_FORMAT outputFormat = OUTPUT_FORMAT_PNG;
+	TEXTURE_CODEC codec = TEXTURE_CODEC_NONE;
+	bool bundle = false;
+	bool writeHeader = false;
+	i32 cutoutTolerance = 0;
+	bool premultiply = false;
+	bool dilate = false;
+	bool groupOpacity = false;
+	bool plan = false;
+	bool stable = false;
+	i32 stableThreshold = 0;
+	i32 tileSize = 0;
+	i32 tileGutter = 4;
+	std::string cachePath;
+	u32 ioDepth = 16;
+	u32 shardIndex = 0;
+	u32 shardCount = 0;
+	bool routeChannels = false;
+	bool grid = false;
+	std::string profilePath;
+	std::string usagePath;
+	std::string profileName;
+	i32 scale = 1;
+	PIXEL_FORMAT pixelFormat = PIXEL_FORMAT_RGBA8;
+	std::vector<TextureArrayDesc> arrays;
 };
 
 static_assert( sizeof( i8 ) == 1 );
@@ -0,0 +1,72 @@
+#
+# Packs the fixture twice, copying its files in sorted and then in reversed order so the directory
+# listings differ, and fails unless both builds write byte identical outputs.
+#
+# cmake -DTEXPACK=<texpack> -DFIXTURE=<folder> -DWORK=<folder> -P determinism.cmake
+#
+
+foreach( var TEXPACK FIXTURE WORK )
+	if ( NOT DEFINED ${var} )
+		message( FATAL_ERROR "${var} is not set" )
+	endif()
+endforeach()
+
+file( GLOB_RECURSE files RELATIVE "${FIXTURE}" "${FIXTURE}/*" )
+list( SORT files )
+
+# each set of options is checked on its own, the png, tex and header writers all have to agree
+set( optionSets
+	"-p 1 -H"
+	"-p 2 -r -c -f tex -z lz4"
+	"-F -G -f tex -z qoi -b"
+)
+
+set( setIndex 0 )
+
+foreach( options IN LISTS optionSets )
+	separate_arguments( args UNIX_COMMAND "${options}" )
+
+	foreach( order sorted reversed )
+		set( root "${WORK}/${setIndex}/${order}" )
+		file( REMOVE_RECURSE "${root}" )
+		file( MAKE_DIRECTORY "${root}/out" )
+
+		set( ordered ${files} )
+		if ( order STREQUAL "reversed" )
+			list( REVERSE ordered )
+		endif()
+
+		foreach( file IN LISTS ordered )
+			get_filename_component( folder "${file}" DIRECTORY )
+			file( COPY "${FIXTURE}/${file}" DESTINATION "${root}/in/${folder}" )
+		endforeach()
+
+		execute_process(
+			COMMAND "${TEXPACK}" "${root}/in" -o "${root}/out" -w 128 -h 128 ${args}
+			RESULT_VARIABLE result
+			OUTPUT_QUIET
+		)
+
+		if ( NOT result EQUAL 0 )
+			message( FATAL_ERROR "texpack ${options} failed with ${result} (${order})" )
+		endif()
+
+		file( GLOB_RECURSE outputs RELATIVE "${root}/out" "${root}/out/*" )
+		list( SORT outputs )
+
+		set( hashes_${order} "" )
+		foreach( output IN LISTS outputs )
+			file( SHA256 "${root}/out/${output}" hash )
+			list( APPEND hashes_${order} "${output} ${hash}" )
+		endforeach()
+	endforeach()
+
+	if ( NOT hashes_sorted STREQUAL hashes_reversed )
+		message( FATAL_ERROR "texpack ${options} wrote different outputs for a reversed directory order\n  sorted:   ${hashes_sorted}\n  reversed: ${hashes_reversed}" )
+	endif()
+
+	list( LENGTH hashes_sorted outputCount )
+	message( STATUS "texpack ${options}: ${outputCount} identical outputs" )
+
+	math( EXPR setIndex "${setIndex} + 1" )
+endforeach()
@@ -0,0 +1,73 @@
+#
+# Packs the fixture and checks the sdf group, where origin.txt sets OR to the centre of the source
+# png, gives that sprite the same origin as centred.txt, which leaves it to the default centre.
+#
+# cmake -DTEXPACK=<texpack> -DFIXTURE=<folder> -DWORK=<folder> -P sdf_origin.cmake
+#
+
+foreach( var TEXPACK FIXTURE WORK )
+	if ( NOT DEFINED ${var} )
+		message( FATAL_ERROR "${var} is not set" )
+	endif()
+endforeach()
+
+# the origin is in stored pixels, with and without padding and with a profile scale on top of the downscale
+set( optionSets
+	"-p 0"
+	"-p 3"
+	"-x ${WORK}/profiles.txt"
+)
+
+file( MAKE_DIRECTORY "${WORK}" )
+file( WRITE "${WORK}/profiles.txt" "PROFILE half\nSCALE 2\n" )
+
+set( setIndex 0 )
+
+foreach( options IN LISTS optionSets )
+	separate_arguments( args UNIX_COMMAND "${options}" )
+
+	set( output "${WORK}/${setIndex}" )
+	file( REMOVE_RECURSE "${output}" )
+	file( MAKE_DIRECTORY "${output}" )
+
+	execute_process(
+		COMMAND "${TEXPACK}" "${FIXTURE}" -o "${output}" -w 128 -h 128 -H ${args}
+		RESULT_VARIABLE result
+		OUTPUT_QUIET
+	)
+
+	if ( NOT result EQUAL 0 )
+		message( FATAL_ERROR "texpack ${options} failed with ${result}" )
+	endif()
+
+	file( GLOB_RECURSE headers "${output}/sdf.h" )
+	if ( NOT headers )
+		message( FATAL_ERROR "texpack ${options} wrote no sdf.h" )
+	endif()
+
+	file( READ "${headers}" header )
+
+	# the SpriteId entries and the origins table are both in .dat order
+	string( REGEX MATCH "enum class SpriteId[^{]*{([^}]*)}" _ "${header}" )
+	string( REGEX MATCHALL "[A-Za-z_][A-Za-z_0-9]*" ids "${CMAKE_MATCH_1}" )
+	string( REGEX MATCH "origins\\[ [0-9]+ \\] =[^{]*{(.*)};" _ "${header}" )
+	string( REGEX MATCHALL "{ -?[0-9]+, -?[0-9]+ }" origins "${CMAKE_MATCH_1}" )
+
+	list( FIND ids "centred" centred )
+	list( FIND ids "origin" origin )
+
+	if ( centred EQUAL -1 OR origin EQUAL -1 )
+		message( FATAL_ERROR "texpack ${options}: sdf.h is missing the centred or origin sprite (${ids})" )
+	endif()
+
+	list( GET origins ${centred} centredOrigin )
+	list( GET origins ${origin} originOrigin )
+
+	if ( NOT centredOrigin STREQUAL originOrigin )
+		message( FATAL_ERROR "texpack ${options}: OR at the source centre gives ${originOrigin}, the default centre is ${centredOrigin}" )
+	endif()
+
+	message( STATUS "texpack ${options}: both origins are ${centredOrigin}" )
+
+	math( EXPR setIndex "${setIndex} + 1" )
+endforeach()